@@ -0,0 +1,199 @@
+/*
+ * Copyright (C) 2026  Miroslav Lichvar <mlichvar@redhat.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <config.h>
+#include <ntpd.h>
+
+#include "adev.h"
+
+/*
+ * Streaming estimators of the Allan and time deviation of the offsets.
+ * The offsets are treated as phase samples, which are passed through a
+ * cascade of octave levels.  Each level decimates the phase by 2 (for the
+ * Allan deviation) and averages it in pairs (for the time deviation), and
+ * accumulates the squared second differences of its input, i.e. a
+ * non-overlapping estimate.  The cost per sample is O(1) amortized and the
+ * memory is fixed.  The sampling interval is assumed to be constant; the
+ * tau of each level is the mean interval between its points.
+ */
+
+struct adev_level {
+	double first_time;
+	double time[2];
+	double phase[2];
+	double mean[2];
+	unsigned long points;
+	double adev_sum;
+	double tdev_sum;
+	double pending_time;
+	double pending_phase;
+	double pending_mean;
+	int pending;
+};
+
+struct adev {
+	struct adev_level levels[ADEV_LEVELS];
+	double interval;
+	double interval_start;
+	struct adev_interval current;
+	struct adev_interval last;
+};
+
+struct adev *adev_create(double interval) {
+	struct adev *adev;
+
+	adev = calloc(1, sizeof *adev);
+	if (!adev) {
+		fprintf(stderr, "Could not allocate memory\n");
+		return NULL;
+	}
+
+	adev->interval = interval;
+
+	return adev;
+}
+
+void adev_destroy(struct adev *adev) {
+	free(adev);
+}
+
+static void add_point(struct adev *adev, int index, double time,
+		      double phase, double mean) {
+	struct adev_level *level;
+	double d;
+
+	for (; index < ADEV_LEVELS; index++) {
+		level = &adev->levels[index];
+
+		if (level->points >= 2) {
+			d = phase - 2.0 * level->phase[1] + level->phase[0];
+			level->adev_sum += d * d;
+			d = mean - 2.0 * level->mean[1] + level->mean[0];
+			level->tdev_sum += d * d;
+		}
+
+		if (level->points == 0)
+			level->first_time = time;
+
+		level->time[0] = level->time[1];
+		level->phase[0] = level->phase[1];
+		level->mean[0] = level->mean[1];
+		level->time[1] = time;
+		level->phase[1] = phase;
+		level->mean[1] = mean;
+		level->points++;
+
+		/* Pass every second point to the next level */
+		if (!level->pending) {
+			level->pending_time = time;
+			level->pending_phase = phase;
+			level->pending_mean = mean;
+			level->pending = 1;
+			return;
+		}
+
+		level->pending = 0;
+		mean = (level->pending_mean + mean) / 2.0;
+		phase = level->pending_phase;
+		time = level->pending_time;
+	}
+}
+
+static void reset_interval(struct adev_interval *interval) {
+	interval->samples = 0;
+	interval->mean = 0.0;
+	interval->rms = 0.0;
+	interval->min = INFINITY;
+	interval->max = -INFINITY;
+}
+
+int adev_add_sample(struct adev *adev, double time, double offset) {
+	struct adev_interval *current = &adev->current;
+	int finished = 0;
+
+	if (current->samples > 0 &&
+	    time - adev->interval_start >= adev->interval) {
+		current->mean /= current->samples;
+		current->rms = sqrt(current->rms / current->samples);
+		adev->last = *current;
+		finished = 1;
+	}
+
+	if (current->samples == 0 || finished) {
+		reset_interval(current);
+		adev->interval_start = time;
+	}
+
+	current->samples++;
+	current->mean += offset;
+	current->rms += offset * offset;
+	if (offset < current->min)
+		current->min = offset;
+	if (offset > current->max)
+		current->max = offset;
+
+	if (adev->levels[0].points > 0 && time <= adev->levels[0].time[1])
+		return finished;
+
+	add_point(adev, 0, time, offset, offset);
+
+	return finished;
+}
+
+int adev_get_interval(struct adev *adev, struct adev_interval *interval) {
+	if (adev->last.samples == 0)
+		return 0;
+
+	*interval = adev->last;
+
+	return 1;
+}
+
+int adev_get_deviation(struct adev *adev, int index, double *tau,
+		       double *allan_dev, double *time_dev) {
+	struct adev_level *level;
+	unsigned long n;
+
+	if (index < 0 || index >= ADEV_LEVELS)
+		return 0;
+
+	level = &adev->levels[index];
+	if (level->points < 3)
+		return 0;
+
+	*tau = (level->time[1] - level->first_time) / (level->points - 1);
+	if (*tau <= 0.0)
+		return 0;
+
+	n = level->points - 2;
+	*allan_dev = sqrt(level->adev_sum / (2.0 * *tau * *tau * n));
+	*time_dev = sqrt(level->tdev_sum / (6.0 * n));
+
+	return 1;
+}
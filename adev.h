@@ -0,0 +1,53 @@
+/*
+ * Copyright (C) 2026  Miroslav Lichvar <mlichvar@redhat.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef HAVE_ADEV_H
+#define HAVE_ADEV_H
+
+/* Number of octaves of tau */
+#define ADEV_LEVELS 16
+
+struct adev;
+
+/* Offset statistics of one interval */
+struct adev_interval {
+	unsigned long samples;
+	double mean;
+	double rms;
+	double min;
+	double max;
+};
+
+struct adev *adev_create(double interval);
+void adev_destroy(struct adev *adev);
+
+/* Add a sample, return 1 if an interval was finished */
+int adev_add_sample(struct adev *adev, double time, double offset);
+
+int adev_get_interval(struct adev *adev, struct adev_interval *interval);
+int adev_get_deviation(struct adev *adev, int index, double *tau,
+		       double *allan_dev, double *time_dev);
+
+#endif
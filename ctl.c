@@ -0,0 +1,202 @@
+/*
+ * Copyright (C) 2026  Miroslav Lichvar <mlichvar@redhat.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <config.h>
+#include <ntpd.h>
+
+#include "adev.h"
+#include "ctl.h"
+#include "refclock.h"
+
+/*
+ * Control socket providing the status of the reference clock.  Each accepted
+ * connection is sent the fields of struct refclockstat and variables provided
+ * by the driver, one name=value pair per line, and closed.  The reply goes to
+ * the connected socket, so clients don't need a path in the root directory
+ * of the process.  The socket only provides the status and is accessible to
+ * all users.
+ */
+
+#define CTL_SOCKET_MODE 0666
+
+#define MAX_REPLY_LENGTH 8192
+
+struct reply {
+	char buf[MAX_REPLY_LENGTH];
+	size_t len;
+};
+
+static void add_line(struct reply *reply, const char *fmt, ...) {
+	va_list ap;
+	int ret;
+
+	if (reply->len >= sizeof reply->buf)
+		return;
+
+	va_start(ap, fmt);
+	ret = vsnprintf(reply->buf + reply->len, sizeof reply->buf - reply->len,
+			fmt, ap);
+	va_end(ap);
+
+	if (ret < 0)
+		return;
+
+	reply->len += ret;
+	if (reply->len > sizeof reply->buf)
+		reply->len = sizeof reply->buf;
+}
+
+static void add_stats(struct reply *reply, struct adev *adev) {
+	struct adev_interval interval;
+	double tau, allan_dev, time_dev;
+	int i;
+
+	if (!adev)
+		return;
+
+	if (adev_get_interval(adev, &interval)) {
+		add_line(reply, "offset_samples=%lu\n", interval.samples);
+		add_line(reply, "offset_mean=%+.9f\n", interval.mean);
+		add_line(reply, "offset_rms=%.9f\n", interval.rms);
+		add_line(reply, "offset_min=%+.9f\n", interval.min);
+		add_line(reply, "offset_max=%+.9f\n", interval.max);
+	}
+
+	for (i = 0; adev_get_deviation(adev, i, &tau, &allan_dev, &time_dev);
+	     i++) {
+		add_line(reply, "adev_%.4g=%.3e\n", tau, allan_dev);
+		add_line(reply, "tdev_%.4g=%.3e\n", tau, time_dev);
+	}
+}
+
+static void make_reply(struct reply *reply, struct refclock_context *refclock) {
+	struct refclockstat stat;
+	struct ctl_var *kv;
+	struct peer *peer;
+	char refid[5];
+
+	peer = refclock_get_peer(refclock);
+
+	memset(&stat, 0, sizeof stat);
+	refclock_control(&peer->srcadr, NULL, &stat);
+
+	memcpy(refid, &stat.fudgeval2, 4);
+	refid[4] = '\0';
+
+	reply->len = 0;
+	add_line(reply, "refclock=%s\n", stoa(&peer->srcadr));
+	add_line(reply, "type=%u\n", stat.type);
+	add_line(reply, "device=\"%s\"\n", stat.clockdesc ? stat.clockdesc : "");
+	add_line(reply, "timecode=\"%.*s\"\n", stat.p_lastcode ? stat.lencode : 0,
+		 stat.p_lastcode ? stat.p_lastcode : "");
+	add_line(reply, "poll=%u\n", stat.polls);
+	add_line(reply, "noreply=%u\n", stat.noresponse);
+	add_line(reply, "badformat=%u\n", stat.badformat);
+	add_line(reply, "baddata=%u\n", stat.baddata);
+	add_line(reply, "timereset=%u\n", stat.timereset);
+	add_line(reply, "fudgetime1=%.3f\n", stat.fudgetime1 * 1e3);
+	add_line(reply, "fudgetime2=%.3f\n", stat.fudgetime2 * 1e3);
+	add_line(reply, "stratum=%d\n", stat.fudgeval1);
+	add_line(reply, "refid=%s\n", refid);
+	add_line(reply, "flags=%u\n", stat.flags);
+	add_line(reply, "status=%u\n", stat.currentstatus);
+	add_line(reply, "lastevent=%u\n", stat.lastevent);
+	add_line(reply, "leap=%u\n", stat.leap);
+
+	for (kv = stat.kv_list; kv && !(kv->flags & EOV); kv++) {
+		if (kv->text)
+			add_line(reply, "%s\n", kv->text);
+	}
+
+	free_varlist(stat.kv_list);
+
+	add_stats(reply, refclock_get_adev(refclock));
+}
+
+int ctl_open(const char *path) {
+	struct sockaddr_un sun;
+	int fd;
+
+	sun.sun_family = AF_UNIX;
+	if (snprintf(sun.sun_path, sizeof sun.sun_path, "%s", path) >=
+	    sizeof (sun.sun_path))
+		return -1;
+
+	fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (fd < 0) {
+		fprintf(stderr, "socket() failed: %m\n");
+		return -1;
+	}
+
+	unlink(sun.sun_path);
+
+	if (bind(fd, (struct sockaddr *)&sun, sizeof (sun)) < 0) {
+		fprintf(stderr, "Could not bind to %s: %m\n", sun.sun_path);
+		close(fd);
+		return -1;
+	}
+
+	/* Don't depend on the umask */
+	if (chmod(sun.sun_path, CTL_SOCKET_MODE) < 0 || listen(fd, 4) < 0) {
+		fprintf(stderr, "Could not set up %s: %m\n", sun.sun_path);
+		close(fd);
+		return -1;
+	}
+
+	DPRINTF(2, ("ctl bound to %s\n", sun.sun_path));
+	return fd;
+}
+
+int ctl_process(int fd, void *arg) {
+	static struct reply reply;
+	int conn_fd;
+
+	conn_fd = accept(fd, NULL, NULL);
+	if (conn_fd < 0) {
+		DPRINTF(2, ("ctl accept() failed: %m\n"));
+		return 1;
+	}
+
+	make_reply(&reply, arg);
+
+	/* The reply fits in the socket buffer */
+	if (send(conn_fd, reply.buf, reply.len, MSG_DONTWAIT | MSG_NOSIGNAL) < 0)
+		DPRINTF(2, ("ctl send() failed: %m\n"));
+
+	close(conn_fd);
+
+	return 1;
+}
+
+int ctl_close(int fd) {
+	return !close(fd);
+}
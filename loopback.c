@@ -0,0 +1,155 @@
+/*
+ * Copyright (C) 2026  Miroslav Lichvar <mlichvar@redhat.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <stdio.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <config.h>
+#include <ntpd.h>
+#include <timespecops.h>
+
+#include "loopback.h"
+
+/*
+ * Synthetic reference clock (type 0), which is not an ntpd driver and
+ * cannot be started by refclock_newpeer().  It generates one timecode per
+ * read of a timerfd expiring at the rate set by the mode option (in Hz), or
+ * of an eventfd which is always readable if the mode is 0.  The timecode is
+ * the receive timestamp of the read and it is processed by
+ * refclock_process() like in other drivers, i.e. the offsets are zero
+ * except for the fudge time and rounding.  It allows measuring the overhead
+ * of the wrapper without a device.
+ */
+
+#define LOOPBACK_REFID "LOOP"
+#define LOOPBACK_DESCRIPTION "Synthetic loopback clock"
+#define LOOPBACK_PRECISION -20
+
+static void loopback_receive(struct recvbuf *rbuf) {
+	struct peer *peer = rbuf->recv_peer;
+	struct refclockproc *pp = peer->procptr;
+	struct timespec ts;
+	struct tm tm;
+	time_t t;
+
+	pp->lastrec = rbuf->recv_time;
+	ts = lfp_stamp_to_tspec(pp->lastrec, NULL);
+	t = ts.tv_sec;
+	if (!gmtime_r(&t, &tm))
+		return;
+
+	pp->year = tm.tm_year + 1900;
+	pp->day = tm.tm_yday + 1;
+	pp->hour = tm.tm_hour;
+	pp->minute = tm.tm_min;
+	pp->second = tm.tm_sec;
+	pp->nsec = ts.tv_nsec;
+
+	pp->lencode = snprintf(pp->a_lastcode, sizeof pp->a_lastcode,
+			       "%04d-%03d %02d:%02d:%02d.%09ld", pp->year,
+			       pp->day, pp->hour, pp->minute, pp->second,
+			       (long)ts.tv_nsec);
+	if (pp->lencode >= sizeof pp->a_lastcode)
+		pp->lencode = sizeof pp->a_lastcode - 1;
+
+	if (!refclock_process(pp))
+		refclock_report(peer, CEVNT_BADTIME);
+}
+
+static int open_fd(int rate) {
+	struct itimerspec its;
+	int fd;
+
+	if (rate == 0) {
+		/* Each read in the semaphore mode decrements the counter */
+		fd = eventfd(0xffffffff, EFD_SEMAPHORE | EFD_NONBLOCK |
+			     EFD_CLOEXEC);
+		if (fd < 0)
+			fprintf(stderr, "eventfd() failed: %m\n");
+		return fd;
+	}
+
+	fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	if (fd < 0) {
+		fprintf(stderr, "timerfd_create() failed: %m\n");
+		return -1;
+	}
+
+	its.it_interval.tv_sec = rate == 1 ? 1 : 0;
+	its.it_interval.tv_nsec = rate == 1 ? 0 : 1000000000 / rate;
+	its.it_value = its.it_interval;
+
+	if (timerfd_settime(fd, 0, &its, NULL)) {
+		fprintf(stderr, "timerfd_settime() failed: %m\n");
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+int loopback_start(struct peer *peer) {
+	struct refclockproc *pp;
+	int fd;
+
+	fd = open_fd(peer->ttl);
+	if (fd < 0)
+		return 0;
+
+	/* Do what refclock_newpeer() does for other drivers */
+	pp = emalloc_zero(sizeof *pp);
+	peer->procptr = pp;
+	peer->refclktype = 0;
+	peer->refclkunit = SRCADR(&peer->srcadr) & 0xff;
+	peer->leap = LEAP_NOTINSYNC;
+	peer->stratum = STRATUM_REFCLOCK;
+	peer->precision = LOOPBACK_PRECISION;
+
+	pp->conf = refclock_conf[0];
+	pp->type = 0;
+	pp->timestarted = current_time;
+	pp->clockdesc = LOOPBACK_DESCRIPTION;
+	pp->leap = LEAP_NOWARNING;
+	memcpy(&pp->refid, LOOPBACK_REFID, 4);
+	peer->refid = pp->refid;
+
+	pp->io.clock_recv = loopback_receive;
+	pp->io.srcclock = peer;
+	pp->io.datalen = 0;
+	pp->io.fd = fd;
+
+	return 1;
+}
+
+void loopback_shutdown(struct peer *peer) {
+	if (!peer->procptr || peer->procptr->io.fd < 0)
+		return;
+
+	close(peer->procptr->io.fd);
+	peer->procptr->io.fd = -1;
+}
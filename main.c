@@ -28,18 +28,23 @@
 #include <pwd.h>
 #include <signal.h>
 #include <stdio.h>
+#include <time.h>
 #include <unistd.h>
 
 #include <config.h>
-#include <ntp_calendar.h>
 #include <ntpd.h>
-#include <recvbuff.h>
 
+#include "ctl.h"
+#include "output.h"
+#include "recorder.h"
 #include "refclock.h"
+#include "server.h"
 #include "sock.h"
+#include "state.h"
 #include "stubs.h"
 
 static int quit_signal;
+static int dump_signal;
 
 static int drop_root_privileges(const char *user, const char *dir) {
 	struct passwd *pw;
@@ -80,12 +85,15 @@ static int drop_root_privileges(const char *user, const char *dir) {
 }
 
 static void handle_signal(int signal) {
-	quit_signal = signal;
+	if (signal == SIGUSR2)
+		dump_signal = signal;
+	else
+		quit_signal = signal;
 }
 
 static int set_signal_handler(void) {
 	struct sigaction sa;
-	int i, signals[] = {SIGINT, SIGTERM, SIGQUIT, SIGHUP};
+	int i, signals[] = {SIGINT, SIGTERM, SIGQUIT, SIGHUP, SIGUSR2};
 
 	sa.sa_handler = handle_signal;
 	sa.sa_flags = SA_RESTART;
@@ -118,11 +126,24 @@ static void print_help(const char *name) {
 		"  flag4 0|1\n"
 		"\nOptions:\n"
 		"  -s SOCKET\tSend samples to chrony refclock SOCKET\n"
+		"  -C SOCKET\tProvide status of the clock on control SOCKET\n"
+		"  -n ADDRESS\tServe time to NTP clients on ADDRESS[:PORT]\n"
+		"  -o FORMAT\tPrint samples in FORMAT: text, json, binary (default: text)\n"
+		"  -L LATENCY\tFlush printed samples after LATENCY ms (default: 0)\n"
 		"  -u USER\tRun as USER (default: " DEFAULT_USER ")\n"
 		"  -r DIR\tChange root directory to DIR (default: " DEFAULT_ROOTDIR ")\n"
 		"  -c FILE\tWrite reference clock statistics to FILE\n"
+		"  -m FILE\tPublish status of the clock in memory-mapped FILE\n"
+		"  -f FILE\tSave and restore date and leap second state in FILE\n"
 		"  -i INTERVAL\tSet minpoll and maxpoll to INTERVAL (default: 6)\n"
 		"  -p AT-COMMAND\tSpecify phone number as AT command for modem drivers\n"
+		"  -a\t\tCompute offset statistics and Allan and time deviation\n"
+		"  -R\t\tRestart the driver on device errors instead of exiting\n"
+		"  -S SECONDS\tDrop samples for SECONDS after a clock step (default: 1)\n"
+		"  -t\t\tDon't wake up every second if the driver has no timer\n"
+		"  -w\t\tLimit CPU latency when data is expected from the device\n"
+		"  -W\t\tLimit CPU latency and busy-poll the device\n"
+		"  -B ITERATIONS\tMeasure the processing time in ITERATIONS of the loop\n"
 		"  -d\t\tIncrease debug level\n"
 		"  -l\t\tPrint available drivers\n"
 		"  -v\t\tPrint version\n"
@@ -180,28 +201,68 @@ static int parse_refclock_args(int argc, char **argv,
 	return 1;
 }
 
-static void print_sample(struct refclock_sample *sample) {
-	printf("SAMPLE: time=%lld.%06u offset=%+.9f leap=%d\n",
-	       (long long)sample->time.tv_sec,
-	       (unsigned int)sample->time.tv_usec,
-	       sample->offset, sample->leap);
+static unsigned long long get_bench_time(int benchmark) {
+	struct timespec ts;
+
+	if (!benchmark || clock_gettime(CLOCK_MONOTONIC, &ts))
+		return 0;
+
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void print_bench(struct refclock_context *refclock,
+			unsigned long iterations, unsigned long long run_ns,
+			unsigned long samples, unsigned long long output_ns) {
+	unsigned long long read_ns;
+	unsigned long reads;
+
+	refclock_get_bench(refclock, &reads, &read_ns);
+
+	fprintf(stderr, "BENCHMARK: iterations=%lu run=%.1fns reads=%lu "
+		"receive=%.1fns samples=%lu output=%.1fns\n", iterations,
+		iterations ? (double)run_ns / iterations : 0.0, reads,
+		reads ? (double)read_ns / reads : 0.0, samples,
+		samples ? (double)output_ns / samples : 0.0);
 }
 
 int main(int argc, char **argv) {
+	struct refclock_context *refclock;
 	struct refclock_config conf;
 	struct refclock_sample sample;
-	const char *user, *dir;
-	int opt, sock;
+	struct ntp_server *server;
+	const char *user, *dir, *server_address, *format, *state;
+	unsigned long long t0, t1, run_ns, output_ns;
+	unsigned long iterations, bench_iterations, samples;
+	int opt, sock, ctl, latency;
 
 	user = DEFAULT_USER;
 	dir = DEFAULT_ROOTDIR;
 	sock = -1;
+	ctl = -1;
+	server_address = NULL;
+	server = NULL;
+	bench_iterations = 0;
+	format = "text";
+	state = NULL;
+	latency = 0;
 
 	memset(&conf, 0, sizeof conf);
 	conf.poll = 6;
 
-	while ((opt = getopt(argc, argv, "+c:dli:p:r:s:u:vh")) != -1) {
+	while ((opt = getopt(argc, argv, "+aB:C:c:df:L:li:m:n:o:p:Rr:S:s:tu:vwWh")) != -1) {
 		switch (opt) {
+		case 'a':
+			conf.stats = 1;
+			break;
+		case 'B':
+			bench_iterations = strtoul(optarg, NULL, 10);
+			conf.benchmark = 1;
+			break;
+		case 'C':
+			ctl = ctl_open(optarg);
+			if (ctl < 0)
+				return 1;
+			break;
 		case 'c':
 			if (!clockstats_open(optarg))
 				return 1;
@@ -209,27 +270,57 @@ int main(int argc, char **argv) {
 		case 'd':
 			debug++;
 			break;
+		case 'f':
+			state = optarg;
+			break;
+		case 'L':
+			latency = atoi(optarg);
+			break;
 		case 'l':
 			refclock_print_drivers();
 			return 0;
 		case 'i':
 			conf.poll = atoi(optarg);
 			break;
+		case 'm':
+			conf.status_file = optarg;
+			break;
+		case 'n':
+			server_address = optarg;
+			break;
+		case 'o':
+			format = optarg;
+			break;
 		case 'p':
 			if (!sys_phone_add(optarg))
 				return 1;
 			break;
+		case 'R':
+			conf.recover = 1;
+			break;
 		case 'r':
 			dir = optarg;
 			break;
+		case 'S':
+			conf.step_settle = atof(optarg);
+			break;
 		case 's':
 			sock = sock_open(optarg);
 			if (sock < 0)
 				return 1;
 			break;
+		case 't':
+			conf.tickless = 1;
+			break;
 		case 'u':
 			user = optarg;
 			break;
+		case 'w':
+			conf.wake_window = 1;
+			break;
+		case 'W':
+			conf.wake_window = 2;
+			break;
 		case 'v':
 			printf("%s %s (ntp-%s)\n",
 			       PROGRAM_NAME, PROGRAM_VERSION, VERSION);
@@ -248,6 +339,10 @@ int main(int argc, char **argv) {
 	if (!parse_refclock_args(argc - optind, argv + optind, &conf))
 		return 1;
 
+	/* Set up buffering of stdout before anything is written to it */
+	if (!output_open(format, latency))
+		return 1;
+
 	progname = argv[0];
 
 	init_logging(progname, 0, 0);
@@ -256,45 +351,104 @@ int main(int argc, char **argv) {
 	msyslog_term = TRUE;
 	msyslog_include_timestamp = FALSE;
 	msyslog_term_pid = FALSE;
-	init_lib();
-	init_refclock();
-	init_recvbuff(4);
+	refclock_init();
 
-#if NTP_RELEASE >= 4020813
-	basedate_set_day(basedate_eval_buildstamp() - 14);
-#endif
+	if (state && !state_open(state))
+		return 1;
 
 	if (!set_signal_handler())
 		return 1;
 
-	if (!refclock_start(&conf))
+	refclock = refclock_start(&conf);
+	if (!refclock)
 		return 1;
 
-	if (geteuid() == 0 && !drop_root_privileges(user, dir))
+	if (ctl >= 0 && !refclock_add_fd(refclock, ctl, ctl_process, refclock))
 		return 1;
 
-	for (quit_signal = 0; !quit_signal; ) {
-		if (!refclock_run())
+	if (output_get_fd() >= 0 &&
+	    !refclock_add_fd(refclock, output_get_fd(), output_process, NULL))
+		return 1;
+
+	if (server_address) {
+		server = server_open(server_address, refclock);
+		if (!server || !refclock_add_fd(refclock, server_get_fd(server),
+						server_process, server))
+			return 1;
+	}
+
+	if (geteuid() == 0) {
+		if (!drop_root_privileges(user, dir))
+			return 1;
+
+		/* The driver is restarted in the new root directory */
+		if (conf.recover && conf.type != 0 && access("/dev", F_OK))
+			fprintf(stderr, "Warning: %s has no /dev, restarts of "
+				"the driver will fail\n", dir);
+	}
+
+	run_ns = output_ns = 0;
+	samples = 0;
+
+	for (quit_signal = 0, iterations = 0; !quit_signal; iterations++) {
+		if (bench_iterations > 0 && iterations >= bench_iterations)
+			break;
+
+		t0 = get_bench_time(conf.benchmark);
+
+		if (!refclock_run(refclock))
 			break;
 
-		if (!refclock_get_raw_sample(&sample))
+		t1 = get_bench_time(conf.benchmark);
+		run_ns += t1 - t0;
+
+		if (dump_signal) {
+			recorder_dump(stderr);
+			dump_signal = 0;
+		}
+
+		if (!refclock_get_raw_sample(refclock, &sample))
 			continue;
 
-		if (sock < 0 || debug > 0)
-			print_sample(&sample);
+		state_update(&sample);
+
+		if (server)
+			server_set_sample(server, &sample);
+
+		if (((sock < 0 && !server) || debug > 0) &&
+		    !output_sample(&sample, &refclock_get_peer(refclock)->srcadr))
+			break;
 
 		if (sock >= 0 && !sock_send_sample(sock, &sample.time,
 						   sample.offset, sample.leap))
 			break;
+
+		output_ns += get_bench_time(conf.benchmark) - t1;
+		samples++;
 	}
 
-	refclock_stop();
+	if (conf.benchmark)
+		print_bench(refclock, iterations, run_ns, samples, output_ns);
+
+	refclock_stop(refclock);
 	clockstats_close();
+	output_close();
+	state_close();
 
 	if (sock >= 0)
 		sock_close(sock);
 
+	if (ctl >= 0)
+		ctl_close(ctl);
+
+	if (server)
+		server_close(server);
+
+	if (bench_iterations > 0 && iterations >= bench_iterations)
+		return 0;
+
 	if (!quit_signal) {
+		recorder_dump(stderr);
 		fprintf(stderr, "Exiting on error\n");
 		return 2;
 	}
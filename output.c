@@ -0,0 +1,204 @@
+/*
+ * Copyright (C) 2026  Miroslav Lichvar <mlichvar@redhat.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+#include <config.h>
+#include <ntpd.h>
+
+#include "output.h"
+#include "refclock.h"
+
+/*
+ * Output of samples to stdout.  The output is fully buffered and flushed
+ * explicitly, either after each sample, or when the oldest unflushed sample
+ * reaches the maximum latency, which is timed by a timerfd polled in the
+ * main loop.  With the machine-readable formats the records are written to
+ * a duplicate of the stdout descriptor and stdout is redirected to stderr,
+ * so messages from the drivers, debug output and clockstats don't corrupt
+ * the stream.
+ */
+
+#define OUTPUT_BUFFER_SIZE 65536
+
+static int output_format;
+static FILE *output_file;
+static int output_latency;
+static int timer_fd = -1;
+static int pending;
+static uint64_t sequence;
+static char output_buffer[OUTPUT_BUFFER_SIZE];
+
+int output_open(const char *format, int latency) {
+	int fd;
+
+	if (!strcmp(format, "text")) {
+		output_format = OUTPUT_TEXT;
+	} else if (!strcmp(format, "json")) {
+		output_format = OUTPUT_JSON;
+	} else if (!strcmp(format, "binary")) {
+		output_format = OUTPUT_BINARY;
+	} else {
+		fprintf(stderr, "Unknown output format %s\n", format);
+		return 0;
+	}
+
+	output_latency = latency > 0 ? latency : 0;
+
+	if (output_format == OUTPUT_TEXT) {
+		output_file = stdout;
+	} else {
+		fd = dup(STDOUT_FILENO);
+		if (fd < 0 || !(output_file = fdopen(fd, "w"))) {
+			fprintf(stderr, "Could not open output: %m\n");
+			if (fd >= 0)
+				close(fd);
+			return 0;
+		}
+		if (dup2(STDERR_FILENO, STDOUT_FILENO) < 0 ||
+		    setvbuf(stdout, NULL, _IOLBF, 0)) {
+			fprintf(stderr, "Could not redirect stdout: %m\n");
+			return 0;
+		}
+	}
+
+	/* Keep debug messages printed with the text format line-buffered */
+	if ((debug == 0 || output_file != stdout) &&
+	    setvbuf(output_file, output_buffer, _IOFBF, sizeof output_buffer)) {
+		fprintf(stderr, "setvbuf() failed\n");
+		return 0;
+	}
+
+	if (output_latency > 0) {
+		timer_fd = timerfd_create(CLOCK_MONOTONIC,
+					  TFD_NONBLOCK | TFD_CLOEXEC);
+		if (timer_fd < 0) {
+			fprintf(stderr, "timerfd_create() failed: %m\n");
+			return 0;
+		}
+	}
+
+	return 1;
+}
+
+int output_get_fd(void) {
+	return timer_fd;
+}
+
+static int flush_output(void) {
+	pending = 0;
+
+	if (fflush(output_file)) {
+		fprintf(stderr, "Could not write samples: %m\n");
+		return 0;
+	}
+
+	return 1;
+}
+
+static int start_timer(void) {
+	struct itimerspec its;
+
+	memset(&its, 0, sizeof its);
+	its.it_value.tv_sec = output_latency / 1000;
+	its.it_value.tv_nsec = output_latency % 1000 * 1000000;
+
+	if (timerfd_settime(timer_fd, 0, &its, NULL)) {
+		fprintf(stderr, "timerfd_settime() failed: %m\n");
+		return 0;
+	}
+
+	return 1;
+}
+
+int output_sample(struct refclock_sample *sample, sockaddr_u *addr) {
+	struct output_record record;
+	int64_t time_ns;
+
+	time_ns = sample->time.tv_sec * 1000000000LL + sample->time.tv_nsec;
+	sequence++;
+
+	switch (output_format) {
+	case OUTPUT_TEXT:
+		fprintf(output_file, "SAMPLE: time=%lld.%09ld offset=%+.9f "
+			"leap=%d\n", (long long)sample->time.tv_sec,
+			(long)sample->time.tv_nsec, sample->offset,
+			sample->leap);
+		break;
+	case OUTPUT_JSON:
+		fprintf(output_file, "{\"seq\":%llu,\"clock\":\"%s\","
+			"\"time\":%lld,\"offset\":%.9f,\"leap\":%d}\n",
+			(unsigned long long)sequence, stoa(addr),
+			(long long)time_ns, sample->offset, sample->leap);
+		break;
+	case OUTPUT_BINARY:
+		memset(&record, 0, sizeof record);
+		record.sequence = sequence;
+		record.time = time_ns;
+		record.offset = sample->offset;
+		record.clock = SRCADR(addr);
+		record.leap = sample->leap;
+		fwrite(&record, sizeof record, 1, output_file);
+		break;
+	}
+
+	if (output_latency == 0)
+		return flush_output();
+
+	if (pending++ == 0)
+		return start_timer();
+
+	return 1;
+}
+
+int output_process(int fd, void *arg) {
+	uint64_t expirations;
+
+	if (read(fd, &expirations, sizeof expirations) < 0)
+		return 1;
+
+	return flush_output();
+}
+
+int output_close(void) {
+	int r = 1;
+
+	if (pending)
+		r = flush_output();
+
+	if (timer_fd >= 0) {
+		close(timer_fd);
+		timer_fd = -1;
+	}
+
+	if (output_file && output_file != stdout)
+		fclose(output_file);
+	output_file = NULL;
+
+	return r;
+}
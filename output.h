@@ -0,0 +1,62 @@
+/*
+ * Copyright (C) 2026  Miroslav Lichvar <mlichvar@redhat.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef HAVE_OUTPUT_H
+#define HAVE_OUTPUT_H
+
+#include <stdint.h>
+
+#define OUTPUT_TEXT 0
+#define OUTPUT_JSON 1
+#define OUTPUT_BINARY 2
+
+/* Record of the binary format (in the native byte order) */
+struct output_record {
+	/* Sequence number of the sample, starting at 1 */
+	uint64_t sequence;
+
+	/* System time of the sample (in nanoseconds since 1970) */
+	int64_t time;
+
+	/* Offset between the true time and the system time (in seconds) */
+	double offset;
+
+	/* Address of the reference clock (127.127.TYPE.UNIT) */
+	uint32_t clock;
+
+	/* 0 - normal, 1 - insert leap second, 2 - delete leap second,
+	   3 - not synchronized */
+	int32_t leap;
+};
+
+struct refclock_sample;
+
+int output_open(const char *format, int latency);
+int output_get_fd(void);
+int output_sample(struct refclock_sample *sample, sockaddr_u *addr);
+int output_process(int fd, void *arg);
+int output_close(void);
+
+#endif
@@ -0,0 +1,126 @@
+/*
+ * Copyright (C) 2026  Miroslav Lichvar <mlichvar@redhat.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "recorder.h"
+
+/*
+ * Flight recorder keeping the last events in memory, so they can be printed
+ * when something goes wrong without the overhead of debug output.  With a
+ * 1-second driver timer and a few reads of the device per second, the
+ * records cover several minutes.
+ */
+
+#define MAX_RECORDS 8192
+#define MAX_TEXT_LENGTH 16
+
+struct record {
+	struct timespec ts;
+	int type;
+	int arg;
+	union {
+		double value;
+		char text[MAX_TEXT_LENGTH];
+	} data;
+};
+
+struct recorder {
+	struct record records[MAX_RECORDS];
+	unsigned int next;
+	unsigned int count;
+};
+
+static struct recorder recorder;
+
+static struct record *get_record(int type, int arg) {
+	struct record *r;
+
+	r = &recorder.records[recorder.next];
+	recorder.next = (recorder.next + 1) % MAX_RECORDS;
+	if (recorder.count < MAX_RECORDS)
+		recorder.count++;
+
+	if (clock_gettime(CLOCK_REALTIME, &r->ts))
+		r->ts.tv_sec = r->ts.tv_nsec = 0;
+	r->type = type;
+	r->arg = arg;
+
+	return r;
+}
+
+void recorder_add(int type, int arg, double value) {
+	get_record(type, arg)->data.value = value;
+}
+
+void recorder_add_text(int type, int arg, const char *text) {
+	struct record *r = get_record(type, arg);
+
+	strncpy(r->data.text, text ? text : "", sizeof r->data.text - 1);
+	r->data.text[sizeof r->data.text - 1] = '\0';
+}
+
+void recorder_dump(FILE *f) {
+	struct record *r;
+	unsigned int i;
+
+	fprintf(f, "Dumping %u records\n", recorder.count);
+
+	for (i = 0; i < recorder.count; i++) {
+		r = &recorder.records[(recorder.next + MAX_RECORDS -
+				       recorder.count + i) % MAX_RECORDS];
+
+		fprintf(f, "RECORD: %lld.%09ld ", (long long)r->ts.tv_sec,
+			r->ts.tv_nsec);
+
+		switch (r->type) {
+		case REC_EVENT:
+			fprintf(f, "event code=%d %s\n", r->arg, r->data.text);
+			break;
+		case REC_READ:
+			fprintf(f, "read length=%d\n", r->arg);
+			break;
+		case REC_FILTER:
+			fprintf(f, "filter offset=%+.9f\n", r->data.value);
+			break;
+		case REC_TIMER:
+			fprintf(f, "timer current_time=%d\n", r->arg);
+			break;
+		case REC_SAMPLE:
+			fprintf(f, "sample offset=%+.9f leap=%d\n",
+				r->data.value, r->arg);
+			break;
+		case REC_STEP:
+			fprintf(f, "step offset=%+.9f\n", r->data.value);
+			break;
+		default:
+			fprintf(f, "unknown type=%d\n", r->type);
+		}
+	}
+
+	fflush(f);
+}
@@ -24,19 +24,33 @@
  */
 
 #include <assert.h>
+#include <errno.h>
 #include <poll.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <sys/timerfd.h>
 #include <sys/types.h>
 #include <time.h>
 #include <unistd.h>
 
 #include <config.h>
+#include <ntp_calendar.h>
 #include <ntpd.h>
 #include <ntp_net.h>
-#include <timevalops.h>
+#include <recvbuff.h>
+#include <timespecops.h>
 
+#include "adev.h"
+#include "loopback.h"
+#include "probes.h"
+#include "recorder.h"
 #include "refclock.h"
+#include "status.h"
 #include "stubs.h"
+#ifdef HAVE_IO_URING
+#include "uring.h"
+#endif
+#include "wake.h"
 
 #include "refclock_names.h"
 
@@ -57,59 +71,209 @@
  *   - refclock_receive() to process accumulated samples
  */
 
+/* Maximum sleep in the tickless mode (in seconds) */
+#define MAX_TICKLESS_SLEEP 1024
+
+/* Maximum number of descriptors polled in addition to the device */
+#define MAX_EXTRA_FDS 4
+
+/* Minimum and maximum interval between attempts to restart a driver after
+   a failure of the device (in seconds) */
+#define MIN_RESTART_INTERVAL 1
+#define MAX_RESTART_INTERVAL 64
+
+/* Maximum number of failed restarts before giving up, which lets a service
+   manager restart the whole process */
+#define MAX_RESTART_FAILURES 10
+
+/* Minimum interval after a step of the system clock when samples are
+   dropped, which covers messages received before the step */
+#define MIN_STEP_SETTLE 1.0
+
+struct refclock_fd {
+	int fd;
+	int (*handler)(int fd, void *arg);
+	void *arg;
+};
+
+/* Counters of the driver kept over its restarts */
+struct refclock_counters {
+	u_long timestarted;
+	u_long polls;
+	u_long noreply;
+	u_long badformat;
+	u_long baddata;
+};
+
 struct refclock_context {
+	struct refclock_context *next;
 	struct peer peer;
-	struct timespec next_timer;
+	struct refclockstat stat;
+	int recover;
+	int down;
+	u_long restart_time;
+	int restart_interval;
+	int restart_failures;
+	struct refclock_counters counters;
+	u_long timer_tick;
 	int prev_coderecv;
+	int tickless;
+	struct wake_window *wake;
+	struct adev *adev;
+	struct status *status;
+	l_fp sample_lastrec;
+	unsigned long reads;
+	l_fp last_read;
+	int step_fd;
+	unsigned long steps;
+	double step_settle;
+	double clock_difference;
+	struct timespec settle_end;
+	int settling;
+	int bench;
+	unsigned long bench_reads;
+	unsigned long long bench_read_ns;
+	struct refclock_fd fds[MAX_EXTRA_FDS];
+	int num_fds;
+	void (*sample_handler)(struct refclock_context *refclock,
+			       struct refclock_sample *sample, void *arg);
+	void *sample_arg;
+#ifdef HAVE_IO_URING
+	int uring;
+	int uring_checked;
+	/* Buffer for reads submitted to io_uring */
+	unsigned char read_buf[sizeof ((struct recvbuf *)NULL)->recv_buffer];
+#endif
 };
 
-static struct refclock_context refclock_context;
+/* All running clocks share current_time, which counts seconds from this
+   monotonic time */
+static struct timespec timer_base;
+static int timer_base_set;
 
-static int receive_data(int fd, struct peer *peer) {
-	struct refclockio *io;
-	struct recvbuf *rbuf;
-	size_t buf_len;
-	ssize_t len;
-	l_fp recv_time;
+static struct refclock_context *refclock_contexts;
 
-	get_systime(&recv_time);
+static int start_peer(struct peer *peer) {
+	return peer->refclktype == 0 ? loopback_start(peer) :
+		refclock_newpeer(peer);
+}
+
+/* Schedule a restart of the driver.  The interval is reset only after data
+   was read from the device, so a device which fails right after each restart
+   is restarted with an increasing interval and counted as failed. */
+static int schedule_restart(struct refclock_context *refclock) {
+	if (refclock->restart_interval == 0) {
+		refclock->restart_interval = MIN_RESTART_INTERVAL;
+		refclock->restart_failures = 0;
+	} else {
+		if (++refclock->restart_failures >= MAX_RESTART_FAILURES) {
+			fprintf(stderr, "Could not restart driver in %d attempts\n",
+				refclock->restart_failures);
+			return 0;
+		}
+		if (refclock->restart_interval < MAX_RESTART_INTERVAL)
+			refclock->restart_interval *= 2;
+	}
+
+	refclock->restart_time = current_time + refclock->restart_interval;
+
+	fprintf(stderr, "Restarting driver in %d seconds\n",
+		refclock->restart_interval);
+
+	return 1;
+}
+
+/* Shut down the driver after a failure of the device and schedule its
+   restart */
+static int stop_device(struct refclock_context *refclock) {
+	struct refclockproc *proc = refclock->peer.procptr;
+
+	refclock->counters.timestarted = proc->timestarted;
+	refclock->counters.polls = proc->polls;
+	refclock->counters.noreply = proc->noreply;
+	refclock->counters.badformat = proc->badformat;
+	refclock->counters.baddata = proc->baddata;
+
+	if (refclock->peer.refclktype == 0)
+		loopback_shutdown(&refclock->peer);
+	refclock_unpeer(&refclock->peer);
+
+	refclock->down = 1;
+
+	return schedule_restart(refclock);
+}
+
+static int restart_device(struct refclock_context *refclock) {
+	struct peer *peer = &refclock->peer;
+	struct refclockproc *proc;
+
+	if (!start_peer(peer)) {
+		fprintf(stderr, "Could not restart driver\n");
+		return schedule_restart(refclock);
+	}
+
+	/* The clock needs to be up to be found by refclock_control() */
+	refclock->down = 0;
+
+	refclock_control(&peer->srcadr, &refclock->stat, NULL);
+
+	proc = peer->procptr;
+	proc->timestarted = refclock->counters.timestarted;
+	proc->polls = refclock->counters.polls;
+	proc->noreply = refclock->counters.noreply;
+	proc->badformat = refclock->counters.badformat;
+	proc->baddata = refclock->counters.baddata;
+
+	refclock->prev_coderecv = proc->coderecv;
+
+	fprintf(stderr, "Driver restarted\n");
+
+	return 1;
+}
+
+static int check_read(struct refclock_context *refclock, ssize_t len) {
+	if (len < 0) {
+		if (errno == EAGAIN)
+			return 1;
+		fprintf(stderr, "read() failed: %m\n");
+	} else {
+		fprintf(stderr, "No more data to read\n");
+	}
+
+	if (!refclock->recover)
+		return 0;
+
+	return stop_device(refclock);
+}
+
+static struct recvbuf *get_recv_buffer(void) {
+	struct recvbuf *rbuf;
 
 	rbuf = get_free_recv_buffer(
 #if NTP_RELEASE >= 4020815
 				    TRUE
 #endif
 				   );
-	if (!rbuf) {
+	if (!rbuf)
 		fprintf(stderr, "Could not get recv buffer\n");
-		return 0;
-	}
 
-	io = &peer->procptr->io;
+	return rbuf;
+}
 
-	buf_len = io->datalen;
-	if (buf_len == 0 || buf_len > sizeof rbuf->recv_buffer)
-		buf_len = sizeof rbuf->recv_buffer;
+static size_t get_read_length(struct peer *peer, size_t size) {
+	size_t buf_len;
 
-	len = read(fd, &rbuf->recv_buffer, buf_len);
+	buf_len = peer->procptr->io.datalen;
+	if (buf_len == 0 || buf_len > size)
+		buf_len = size;
 
-	if (len <= 0) {
-		freerecvbuf(rbuf);
-
-		if (len < 0) {
-			if (errno == EAGAIN)
-				return 1;
-			fprintf(stderr, "read() failed: %m\n");
-		} else {
-			fprintf(stderr, "No more data to read\n");
-		}
+	return buf_len;
+}
 
-		return 0;
-	}
+static void process_data(struct recvbuf *rbuf, struct peer *peer) {
+	struct refclockio *io;
 
-	rbuf->fd = fd;
-	rbuf->recv_length = len;
-	rbuf->recv_peer = peer;
-	rbuf->recv_time = recv_time;
+	io = &peer->procptr->io;
 
 	assert(!has_full_recv_buffer());
 
@@ -126,112 +290,711 @@ static int receive_data(int fd, struct peer *peer) {
 			io->clock_recv(rbuf);
 		freerecvbuf(rbuf);
 	}
+}
+
+static int receive_data(struct refclock_context *refclock, int fd) {
+	struct peer *peer = &refclock->peer;
+	struct recvbuf *rbuf;
+	ssize_t len;
+	l_fp recv_time;
+
+	get_systime(&recv_time);
+
+	rbuf = get_recv_buffer();
+	if (!rbuf)
+		return 0;
+
+	len = read(fd, &rbuf->recv_buffer,
+		   get_read_length(peer, sizeof rbuf->recv_buffer));
+
+	PROBE(read, fd, len, recv_time.l_ui, recv_time.l_uf);
+	recorder_add(REC_READ, len, 0.0);
+
+	if (len <= 0) {
+		freerecvbuf(rbuf);
+		return check_read(refclock, len);
+	}
+
+	if (refclock->wake)
+		wake_add_data(refclock->wake, &recv_time);
+
+	refclock->reads++;
+	refclock->last_read = recv_time;
+	refclock->restart_interval = 0;
+
+	rbuf->fd = fd;
+	rbuf->recv_length = len;
+	rbuf->recv_peer = peer;
+	rbuf->recv_time = recv_time;
+
+	process_data(rbuf, peer);
 
 	return 1;
 }
 
-int refclock_start(struct refclock_config *conf) {
-	struct refclock_context *refclock = &refclock_context;
+#ifdef HAVE_IO_URING
+/* Pass data read by io_uring to the driver */
+static int receive_read_data(struct refclock_context *refclock, int fd,
+			     ssize_t len) {
 	struct peer *peer = &refclock->peer;
+	struct recvbuf *rbuf;
+	l_fp recv_time;
 
-	if (conf->type == 0 || conf->type >= num_refclock_conf) {
-		fprintf(stderr, "Invalid refclock type %u\n", conf->type);
+	get_systime(&recv_time);
+
+	PROBE(read, fd, len, recv_time.l_ui, recv_time.l_uf);
+	recorder_add(REC_READ, len, 0.0);
+
+	if (len <= 0) {
+		if (len < 0)
+			errno = -len;
+		return check_read(refclock, len);
+	}
+
+	if (refclock->wake)
+		wake_add_data(refclock->wake, &recv_time);
+
+	refclock->reads++;
+	refclock->last_read = recv_time;
+	refclock->restart_interval = 0;
+
+	rbuf = get_recv_buffer();
+	if (!rbuf)
+		return 0;
+
+	memcpy(&rbuf->recv_buffer, refclock->read_buf, len);
+	rbuf->fd = fd;
+	rbuf->recv_length = len;
+	rbuf->recv_peer = peer;
+	rbuf->recv_time = recv_time;
+
+	process_data(rbuf, peer);
+
+	return 1;
+}
+#endif
+
+static int get_monotonic_time(struct timespec *ts) {
+	if (clock_gettime(CLOCK_MONOTONIC, ts)) {
+		fprintf(stderr, "clock_gettime() failed: %m\n");
+		return 0;
+	}
+
+	return 1;
+}
+
+static int update_current_time(struct timespec *now) {
+	u_long t;
+
+	if (!get_monotonic_time(now))
+		return 0;
+
+	t = now->tv_sec - timer_base.tv_sec -
+		(now->tv_nsec < timer_base.tv_nsec);
+	if (t > current_time)
+		current_time = t;
+
+	return 1;
+}
+
+/* Run the timer of the driver if current_time advanced since its last run.
+   In the tickless mode this may cover multiple seconds. */
+static int run_timer(struct refclock_context *refclock) {
+	struct peer *peer = &refclock->peer;
+	u_long ticks;
+
+	ticks = current_time - refclock->timer_tick;
+	if (ticks == 0)
+		return 1;
+
+	refclock->timer_tick = current_time;
+
+	if (refclock->down && refclock->restart_time <= current_time &&
+	    !restart_device(refclock))
+		return 0;
+
+	if (refclock->status)
+		status_update_timer(refclock->status, peer, refclock->reads,
+				    &refclock->last_read);
+
+	if (refclock->down)
+		return 1;
+
+	PROBE(timer, current_time, ticks);
+	recorder_add(REC_TIMER, current_time, 0.0);
+
+	sys_leap_update();
+
+	refclock_timer(peer);
+
+	if (peer->nextdate <= current_time)
+		refclock_transmit(peer);
+
+	return 1;
+}
+
+/* Get the value of current_time when the timer needs to run next */
+static u_long get_next_tick(struct refclock_context *refclock) {
+	struct peer *peer = &refclock->peer;
+	struct refclockproc *proc = peer->procptr;
+	u_long next, service;
+
+	next = refclock->timer_tick + 1;
+
+	if (refclock->down)
+		return refclock->restart_time > next ? refclock->restart_time : next;
+
+	if (!refclock->tickless)
+		return next;
+
+	/* Sleep until the next poll or action of the driver */
+	service = peer->nextdate;
+	if (proc->action && proc->nextaction < service)
+		service = proc->nextaction;
+
+	if (service > next + MAX_TICKLESS_SLEEP)
+		service = next + MAX_TICKLESS_SLEEP;
+
+	return service > next ? service : next;
+}
+
+static int get_timeout(struct refclock_context *refclock,
+		       struct timespec *now) {
+	struct timespec deadline;
+	long long ns;
+
+	deadline = timer_base;
+	deadline.tv_sec += get_next_tick(refclock);
+
+	ns = (deadline.tv_sec - now->tv_sec) * 1000000000LL +
+		(deadline.tv_nsec - now->tv_nsec);
+
+	/* Round up to not wake up before the deadline */
+	return ns > 0 ? (ns + 999999) / 1000000 : 0;
+}
+
+static void start_bench(struct refclock_context *refclock,
+			struct timespec *start) {
+	if (refclock->bench)
+		clock_gettime(CLOCK_MONOTONIC, start);
+}
+
+static void finish_bench(struct refclock_context *refclock,
+			 struct timespec *start) {
+	struct timespec end;
+
+	if (!refclock->bench)
+		return;
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	refclock->bench_read_ns += (end.tv_sec - start->tv_sec) * 1000000000LL +
+		end.tv_nsec - start->tv_nsec;
+	refclock->bench_reads++;
+}
+
+/* Get the difference between the realtime and monotonic clocks */
+static double get_clock_difference(void) {
+	struct timespec rt, mono;
+
+	if (clock_gettime(CLOCK_REALTIME, &rt) ||
+	    clock_gettime(CLOCK_MONOTONIC, &mono))
+		return 0.0;
+
+	return rt.tv_sec - mono.tv_sec + (rt.tv_nsec - mono.tv_nsec) / 1e9;
+}
+
+/* Set a timer which never expires, but is cancelled on a clock step */
+static int arm_step_timer(int fd) {
+	struct itimerspec its;
+
+	memset(&its, 0, sizeof its);
+	its.it_value.tv_sec = sizeof (time_t) > 4 ? (time_t)1 << 32 : 0x7fffffff;
+
+	if (timerfd_settime(fd, TFD_TIMER_ABSTIME | TFD_TIMER_CANCEL_ON_SET,
+			    &its, NULL)) {
+		fprintf(stderr, "timerfd_settime() failed: %m\n");
+		return 0;
+	}
+
+	return 1;
+}
+
+static int handle_step(int fd, void *arg) {
+	struct refclock_context *refclock = arg;
+	struct refclockproc *proc = refclock->peer.procptr;
+	uint64_t expirations;
+	double diff, step;
+
+	if (read(fd, &expirations, sizeof expirations) >= 0 ||
+	    errno != ECANCELED)
+		return 1;
+
+	diff = get_clock_difference();
+	step = diff - refclock->clock_difference;
+	refclock->clock_difference = diff;
+	refclock->steps++;
+
+	DPRINTF(1, ("system clock stepped by %+.6f seconds\n", step));
+	PROBE(step, (long long)(step * 1e9));
+	recorder_add(REC_STEP, 0, step);
+
+	/* Drop offsets measured before the step, including a sample made in
+	   this iteration */
+	if (proc) {
+		proc->codeproc = proc->coderecv;
+		refclock->prev_coderecv = proc->coderecv;
+	}
+
+	if (!get_monotonic_time(&refclock->settle_end))
 		return 0;
-	} else if (refclock_conf[conf->type]->clock_start == noentry) {
+	refclock->settle_end.tv_sec += (time_t)refclock->step_settle;
+	refclock->settle_end.tv_nsec += (refclock->step_settle -
+		(time_t)refclock->step_settle) * 1e9;
+	if (refclock->settle_end.tv_nsec >= 1000000000) {
+		refclock->settle_end.tv_sec++;
+		refclock->settle_end.tv_nsec -= 1000000000;
+	}
+	refclock->settling = 1;
+
+	return arm_step_timer(fd);
+}
+
+/* Check if samples should be dropped after a step */
+static int check_settling(struct refclock_context *refclock) {
+	struct timespec now;
+
+	if (!refclock->settling)
+		return 0;
+
+	if (!get_monotonic_time(&now))
+		return 1;
+
+	if (now.tv_sec < refclock->settle_end.tv_sec ||
+	    (now.tv_sec == refclock->settle_end.tv_sec &&
+	     now.tv_nsec < refclock->settle_end.tv_nsec))
+		return 1;
+
+	refclock->settling = 0;
+
+	return 0;
+}
+
+/* Pass a new sample to the handler if one is set */
+static void handle_sample(struct refclock_context *refclock) {
+	struct refclock_sample sample;
+
+	if (!refclock->sample_handler ||
+	    !refclock_get_raw_sample(refclock, &sample))
+		return;
+
+	refclock->prev_coderecv = refclock->peer.procptr->coderecv;
+
+	refclock->sample_handler(refclock, &sample, refclock->sample_arg);
+}
+
+/* Wait for events like poll(), with io_uring reading the device if active */
+static int wait_fds(struct refclock_context *refclock, struct pollfd *fds,
+		    int nfds, int timeout, ssize_t *len) {
+	int ret;
+
+#ifdef HAVE_IO_URING
+	if (refclock->uring) {
+		ret = uring_wait(fds, nfds, refclock->read_buf,
+				 get_read_length(&refclock->peer,
+						 sizeof refclock->read_buf),
+				 timeout, len);
+		if (ret < 0 && errno != EINTR)
+			fprintf(stderr, "io_uring_enter() failed: %m\n");
+		return ret;
+	}
+#endif
+
+	ret = poll(fds, nfds, timeout);
+	if (ret < 0 && errno != EINTR)
+		fprintf(stderr, "poll() failed: %m\n");
+
+	return ret;
+}
+
+void refclock_init(void) {
+	init_lib();
+	init_refclock();
+	init_recvbuff(4);
+
+#if NTP_RELEASE >= 4020813
+	basedate_set_day(basedate_eval_buildstamp() - 14);
+#endif
+}
+
+struct refclock_context *refclock_start(struct refclock_config *conf) {
+	struct refclock_context *refclock;
+	struct timespec ts_now;
+	struct peer *peer;
+
+	if (conf->type >= num_refclock_conf) {
+		fprintf(stderr, "Invalid refclock type %u\n", conf->type);
+		return NULL;
+	} else if (conf->type != 0 &&
+		   refclock_conf[conf->type]->clock_start == noentry) {
 		fprintf(stderr, "Missing driver for refclock type %u\n",
 			conf->type);
-		return 0;
+		return NULL;
 	}
 
-	memset(peer, 0, sizeof *peer);
+	/* The mode is passed to drivers in the 8-bit ttl field */
+	if (conf->type == 0 && conf->mode > 255) {
+		fprintf(stderr, "Invalid mode %u\n", conf->mode);
+		return NULL;
+	}
+
+	if (!timer_base_set) {
+		if (!get_monotonic_time(&timer_base))
+			return NULL;
+		/* Run the timer of the first clock immediately */
+		timer_base.tv_sec--;
+		timer_base_set = 1;
+	}
+
+	if (!update_current_time(&ts_now))
+		return NULL;
+
+	refclock = calloc(1, sizeof *refclock);
+	if (!refclock) {
+		fprintf(stderr, "Could not allocate memory\n");
+		return NULL;
+	}
+
+	refclock->step_fd = -1;
+	peer = &refclock->peer;
 
 	AF(&peer->srcadr) = AF_INET;
 	SET_ADDR4(&peer->srcadr, REFCLOCK_ADDR | conf->type << 8 | conf->unit);
 	peer->ttl = conf->mode;
 	peer->hpoll = peer->minpoll = peer->maxpoll = conf->poll;
 
-	if (!refclock_newpeer(peer))
-		return 0;
+	/* Make the clock visible to refclock_control() */
+	refclock->next = refclock_contexts;
+	refclock_contexts = refclock;
+
+	if (conf->type == 0 ? !loopback_start(peer) : !refclock_newpeer(peer)) {
+		refclock_contexts = refclock->next;
+		free(refclock);
+		return NULL;
+	}
 
 	refclock_control(&peer->srcadr, &conf->stat, NULL);
 
-	refclock->next_timer.tv_sec = 0;
-	refclock->next_timer.tv_nsec = 0;
+	/* Keep the settings for restarts of the driver */
+	refclock->stat = conf->stat;
+	refclock->recover = conf->recover;
+
+	refclock->timer_tick = current_time - 1;
+	refclock->bench = conf->benchmark;
+
+	/* Drivers which have a timer need to be called every second */
+	refclock->tickless = conf->tickless &&
+		refclock_conf[conf->type]->clock_timer == noentry;
+	if (conf->tickless && !refclock->tickless)
+		DPRINTF(1, ("driver has a timer, disabling tickless mode\n"));
+
+	if (conf->wake_window) {
+		refclock->wake = wake_create(conf->wake_window > 1);
+		if (!refclock->wake) {
+			refclock_stop(refclock);
+			return NULL;
+		}
+	}
+
+	/* Watch for steps of the system clock */
+	refclock->step_settle = conf->step_settle > MIN_STEP_SETTLE ?
+		conf->step_settle : MIN_STEP_SETTLE;
+	refclock->clock_difference = get_clock_difference();
+	refclock->step_fd = timerfd_create(CLOCK_REALTIME,
+					   TFD_NONBLOCK | TFD_CLOEXEC);
+	if (refclock->step_fd < 0) {
+		DPRINTF(1, ("timerfd_create() failed: %m\n"));
+	} else if (!arm_step_timer(refclock->step_fd) ||
+		   !refclock_add_fd(refclock, refclock->step_fd, handle_step,
+				    refclock)) {
+		refclock_stop(refclock);
+		return NULL;
+	}
+
+	if (conf->status_file) {
+		refclock->status = status_open(conf->status_file,
+					       &peer->srcadr);
+		if (!refclock->status) {
+			refclock_stop(refclock);
+			return NULL;
+		}
+	}
+
+	if (conf->stats) {
+		refclock->adev = adev_create(1 << conf->poll);
+		if (!refclock->adev) {
+			refclock_stop(refclock);
+			return NULL;
+		}
+	}
+
+	return refclock;
+}
+
+int refclock_get_fd(struct refclock_context *refclock) {
+	if (refclock->down)
+		return -1;
+
+	/* Some drivers change io.fd after start */
+	return refclock->peer.procptr->io.fd;
+}
+
+int refclock_get_timeout(struct refclock_context *refclock) {
+	struct timespec ts_now;
+
+	if (!get_monotonic_time(&ts_now))
+		return 0;
+
+	return get_timeout(refclock, &ts_now);
+}
+
+int refclock_process_events(struct refclock_context *refclock, int readable) {
+	struct peer *peer = &refclock->peer;
+	struct timespec ts_now, ts_bench;
+
+	if (!refclock->down)
+		refclock->prev_coderecv = peer->procptr->coderecv;
+
+	if (!update_current_time(&ts_now))
+		return 0;
+
+	/* The descriptor may have been fetched before the device was stopped */
+	if (readable && !refclock->down) {
+		start_bench(refclock, &ts_bench);
+		if (!receive_data(refclock, refclock_get_fd(refclock)))
+			return 0;
+		finish_bench(refclock, &ts_bench);
+	}
+
+	if (!run_timer(refclock))
+		return 0;
+
+	/* The step timer is not polled by the external loop, but a cancelled
+	   timer can be checked with a non-blocking read */
+	if (refclock->step_fd >= 0 && !handle_step(refclock->step_fd, refclock))
+		return 0;
+
+	handle_sample(refclock);
 
 	return 1;
 }
 
-int refclock_run(void) {
-	struct refclock_context *refclock = &refclock_context;
+int refclock_run(struct refclock_context *refclock) {
 	struct peer *peer = &refclock->peer;
-	struct refclockproc *proc = peer->procptr;
-	struct timespec ts_now;
-	struct pollfd fd;
-	int ret, timeout;
+	struct pollfd fds[MAX_EXTRA_FDS + 1];
+	struct timespec ts_now, ts_bench;
+	int i, ret, nfds, timeout;
+	ssize_t len;
 
-	if (clock_gettime(CLOCK_MONOTONIC, &ts_now)) {
-		fprintf(stderr, "clock_gettime() failed: %m\n");
+#ifdef HAVE_IO_URING
+	/* Only one clock can use io_uring, others and all clocks on systems
+	   without io_uring fall back to poll() */
+	if (!refclock->uring_checked) {
+		refclock->uring = uring_open();
+		refclock->uring_checked = 1;
+	}
+#endif
+
+	if (!refclock->down)
+		refclock->prev_coderecv = peer->procptr->coderecv;
+
+	if (!get_monotonic_time(&ts_now))
 		return 0;
+
+	timeout = get_timeout(refclock, &ts_now);
+
+	if (refclock->wake)
+		timeout = wake_adjust_timeout(refclock->wake, timeout);
+
+	fds[0].fd = refclock_get_fd(refclock);
+	fds[0].events = POLLIN | POLLPRI;
+
+	for (i = 0; i < refclock->num_fds; i++) {
+		fds[i + 1].fd = refclock->fds[i].fd;
+		fds[i + 1].events = POLLIN;
 	}
 
-	if (ts_now.tv_sec > refclock->next_timer.tv_sec ||
-	    (ts_now.tv_sec == refclock->next_timer.tv_sec &&
-	     ts_now.tv_nsec >= refclock->next_timer.tv_nsec))
-		refclock->next_timer = ts_now;
+	nfds = refclock->num_fds + 1;
 
-	timeout = (refclock->next_timer.tv_sec - ts_now.tv_sec) * 1000 +
-		(refclock->next_timer.tv_nsec - ts_now.tv_nsec) / 1000000;
+	PROBE(wait, fds[0].fd, nfds, timeout);
 
-	/* Some drivers change io.fd after start */
-	fd.fd = proc->io.fd;
-	fd.events = POLLIN | POLLPRI;
+	ret = wait_fds(refclock, fds, nfds, timeout, &len);
 
-	refclock->prev_coderecv = proc->coderecv;
+	PROBE(wakeup, ret, fds[0].revents);
 
-	ret = poll(&fd, 1, timeout);
+	if (ret < 0)
+		return errno == EINTR;
 
-	if (ret < 0) {
-		if (errno == EINTR)
-			return 1;
-		fprintf(stderr, "poll() failed: %m\n");
+	if (!update_current_time(&ts_now))
 		return 0;
-	} else if (ret > 0) {
-		assert(fd.revents);
-		if (!receive_data(fd.fd, peer))
+
+	if (ret > 0 && fds[0].revents) {
+		start_bench(refclock, &ts_bench);
+#ifdef HAVE_IO_URING
+		if (refclock->uring) {
+			if (!receive_read_data(refclock, fds[0].fd, len))
+				return 0;
+		} else
+#endif
+		if (!receive_data(refclock, fds[0].fd))
 			return 0;
-	} else {
-		current_time++;
-		refclock->next_timer.tv_sec++;
+		finish_bench(refclock, &ts_bench);
+	}
+
+	if (!run_timer(refclock))
+		return 0;
 
-		sys_leap_update();
+	for (i = 1; ret > 0 && i < nfds; i++) {
+		if (fds[i].revents &&
+		    !refclock->fds[i - 1].handler(fds[i].fd,
+						  refclock->fds[i - 1].arg))
+			return 0;
+	}
+
+	handle_sample(refclock);
 
-		refclock_timer(peer);
+	return 1;
+}
 
-		if (peer->nextdate <= current_time)
-			refclock_transmit(peer);
+int refclock_add_fd(struct refclock_context *refclock, int fd,
+		    int (*handler)(int fd, void *arg), void *arg) {
+	if (refclock->num_fds >= MAX_EXTRA_FDS) {
+		fprintf(stderr, "Too many descriptors\n");
+		return 0;
 	}
 
+	refclock->fds[refclock->num_fds].fd = fd;
+	refclock->fds[refclock->num_fds].handler = handler;
+	refclock->fds[refclock->num_fds].arg = arg;
+	refclock->num_fds++;
+
 	return 1;
 }
 
-void refclock_stop(void) {
-	struct refclock_context *refclock = &refclock_context;
+void refclock_set_sample_handler(struct refclock_context *refclock,
+				 void (*handler)(struct refclock_context *refclock,
+						 struct refclock_sample *sample,
+						 void *arg),
+				 void *arg) {
+	refclock->sample_handler = handler;
+	refclock->sample_arg = arg;
+}
+
+void refclock_stop(struct refclock_context *refclock) {
+	struct refclock_context **r;
+
+	if (refclock->peer.refclktype == 0)
+		loopback_shutdown(&refclock->peer);
 
 	refclock_unpeer(&refclock->peer);
+
+	if (refclock->wake)
+		wake_destroy(refclock->wake);
+
+	if (refclock->adev)
+		adev_destroy(refclock->adev);
+
+	if (refclock->status)
+		status_close(refclock->status);
+
+	if (refclock->step_fd >= 0)
+		close(refclock->step_fd);
+
+#ifdef HAVE_IO_URING
+	if (refclock->uring)
+		uring_close();
+#endif
+
+	for (r = &refclock_contexts; *r; r = &(*r)->next) {
+		if (*r == refclock) {
+			*r = refclock->next;
+			break;
+		}
+	}
+
+	free(refclock);
 }
 
-int refclock_get_raw_sample(struct refclock_sample *sample) {
-	struct refclock_context *refclock = &refclock_context;
+/* Write statistics of the last interval to clockstats */
+static void report_stats(struct refclock_context *refclock) {
+	struct adev_interval interval;
+	double tau, allan_dev, time_dev;
+	char adev_buf[512], tdev_buf[512];
+	int i, alen, tlen;
+
+	if (!adev_get_interval(refclock->adev, &interval))
+		return;
+
+	snprintf(adev_buf, sizeof adev_buf,
+		 "offset samples=%lu mean=%+.9f rms=%.9f min=%+.9f max=%+.9f",
+		 interval.samples, interval.mean, interval.rms, interval.min,
+		 interval.max);
+	record_clock_stats(&refclock->peer.srcadr, adev_buf);
+
+	alen = snprintf(adev_buf, sizeof adev_buf, "adev");
+	tlen = snprintf(tdev_buf, sizeof tdev_buf, "tdev");
+
+	for (i = 0; i < ADEV_LEVELS; i++) {
+		if (!adev_get_deviation(refclock->adev, i, &tau, &allan_dev,
+					&time_dev))
+			break;
+		alen += snprintf(adev_buf + alen, sizeof adev_buf - alen,
+				 " %.4g:%.3e", tau, allan_dev);
+		tlen += snprintf(tdev_buf + tlen, sizeof tdev_buf - tlen,
+				 " %.4g:%.3e", tau, time_dev);
+	}
+
+	if (i > 0) {
+		record_clock_stats(&refclock->peer.srcadr, adev_buf);
+		record_clock_stats(&refclock->peer.srcadr, tdev_buf);
+	}
+}
+
+int refclock_get_raw_sample(struct refclock_context *refclock,
+			    struct refclock_sample *sample) {
 	struct refclockproc *proc = refclock->peer.procptr;
 
 	/* Check if a new offset was pushed to the filter */
-	if (refclock->prev_coderecv == proc->coderecv)
+	if (refclock->down || refclock->prev_coderecv == proc->coderecv)
+		return 0;
+
+	if (check_settling(refclock)) {
+		DPRINTF(2, ("dropping sample after clock step\n"));
 		return 0;
+	}
 
-	sample->time = lfp_stamp_to_tval(proc->lastrec, NULL);
+	sample->time = lfp_stamp_to_tspec(proc->lastrec, NULL);
 	sample->offset = proc->filter[proc->coderecv];
 	sample->leap = proc->leap;
 
+	PROBE(sample, (long long)sample->time.tv_sec, (long)sample->time.tv_nsec,
+	      (long long)(sample->offset * 1e9), sample->leap);
+	recorder_add(REC_SAMPLE, sample->leap, sample->offset);
+
+	/* The same sample may be requested multiple times */
+	if (proc->lastrec.l_ui == refclock->sample_lastrec.l_ui &&
+	    proc->lastrec.l_uf == refclock->sample_lastrec.l_uf)
+		return 1;
+
+	refclock->sample_lastrec = proc->lastrec;
+
+	if (refclock->adev &&
+	    adev_add_sample(refclock->adev, sample->time.tv_sec +
+			    sample->time.tv_nsec / 1e9, sample->offset))
+		report_stats(refclock);
+
+	if (refclock->status)
+		status_update_sample(refclock->status, sample);
+
 	return 1;
 }
 
@@ -239,6 +1002,8 @@ void refclock_print_drivers(void) {
 	const char *name;
 	int i, j;
 
+	printf("127.127.0.*\tLOOPBACK\n");
+
 	for (i = 0; i < num_refclock_conf; i++) {
 		if (refclock_conf[i]->clock_start == noentry)
 			continue;
@@ -253,8 +1018,32 @@ void refclock_print_drivers(void) {
 	}
 }
 
-struct peer *refclock_get_peer(void) {
-	struct refclock_context *refclock = &refclock_context;
+void refclock_get_bench(struct refclock_context *refclock,
+			unsigned long *reads, unsigned long long *read_ns) {
+	*reads = refclock->bench_reads;
+	*read_ns = refclock->bench_read_ns;
+}
+
+struct adev *refclock_get_adev(struct refclock_context *refclock) {
+	return refclock->adev;
+}
+
+unsigned long refclock_get_steps(struct refclock_context *refclock) {
+	return refclock->steps;
+}
 
+struct peer *refclock_get_peer(struct refclock_context *refclock) {
 	return &refclock->peer;
 }
+
+struct peer *refclock_find_peer(sockaddr_u *addr) {
+	struct refclock_context *refclock;
+
+	/* Clocks with a stopped driver have no refclockproc */
+	for (refclock = refclock_contexts; refclock; refclock = refclock->next) {
+		if (!refclock->down && SOCK_EQ(addr, &refclock->peer.srcadr))
+			return &refclock->peer;
+	}
+
+	return NULL;
+}
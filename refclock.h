@@ -31,22 +31,70 @@ struct refclock_config {
 	unsigned int unit;
 	unsigned int mode;
 	unsigned char poll;
+	int tickless;
+	int wake_window;
+	int stats;
+	double step_settle;
+	int benchmark;
+	int recover;
+	const char *status_file;
 	struct refclockstat stat;
 };
 
 struct refclock_sample {
-	struct timeval time;
+	struct timespec time;
 	double offset;
 	int leap;
 };
 
-int refclock_start(struct refclock_config *conf);
-int refclock_run(void);
-int refclock_get_raw_sample(struct refclock_sample *sample);
-void refclock_stop(void);
+/* Opaque context of a running clock.  Multiple clocks can run in one process,
+   but they all need to be handled in the same thread. */
+struct refclock_context;
+
+void refclock_init(void);
+
+struct refclock_context *refclock_start(struct refclock_config *conf);
+void refclock_stop(struct refclock_context *refclock);
+
+/* Wait for and process the next event with a built-in poll() loop */
+int refclock_run(struct refclock_context *refclock);
+
+/* Interface for an external event loop.  The descriptor (which can change)
+   should be polled for reading with the timeout (in milliseconds) and
+   refclock_process_events() called when it is readable or the timeout
+   expired.  Steps of the system clock are checked on each call, descriptors
+   added by refclock_add_fd() are polled only by refclock_run(). */
+int refclock_get_fd(struct refclock_context *refclock);
+int refclock_get_timeout(struct refclock_context *refclock);
+int refclock_process_events(struct refclock_context *refclock, int readable);
+
+/* Get a new sample from the last refclock_run() or refclock_process_events()
+   call, or have the samples passed to a handler */
+int refclock_get_raw_sample(struct refclock_context *refclock,
+			    struct refclock_sample *sample);
+void refclock_set_sample_handler(struct refclock_context *refclock,
+				 void (*handler)(struct refclock_context *refclock,
+						 struct refclock_sample *sample,
+						 void *arg),
+				 void *arg);
+
+int refclock_add_fd(struct refclock_context *refclock, int fd,
+		    int (*handler)(int fd, void *arg), void *arg);
 
 void refclock_print_drivers(void);
 
-struct peer *refclock_get_peer(void);
+/* Number of reads from the device and time spent in receiving and processing
+   the data (if benchmark is enabled in the config) */
+void refclock_get_bench(struct refclock_context *refclock,
+			unsigned long *reads, unsigned long long *read_ns);
+
+/* Offset statistics and deviations (if enabled in the config), see adev.h */
+struct adev *refclock_get_adev(struct refclock_context *refclock);
+
+/* Number of detected steps of the system clock */
+unsigned long refclock_get_steps(struct refclock_context *refclock);
+
+struct peer *refclock_get_peer(struct refclock_context *refclock);
+struct peer *refclock_find_peer(sockaddr_u *addr);
 
 #endif
@@ -0,0 +1,315 @@
+/*
+ * Copyright (C) 2026  Miroslav Lichvar <mlichvar@redhat.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <math.h>
+#include <netdb.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <config.h>
+#include <ntpd.h>
+
+#include "refclock.h"
+#include "server.h"
+
+/*
+ * Minimal NTP server answering client requests with the time of the system
+ * clock corrected by the offset of the last sample of the reference clock.
+ * The receive timestamp is captured by the kernel, the transmit timestamp
+ * is taken just before the response is sent.
+ */
+
+#define DEFAULT_PORT "123"
+#define SERVER_PRECISION -20
+#define SERVER_DISPERSION 1e-6
+#define MAX_SAMPLE_POLLS 4
+#define MAX_SYNC_DRIFT 15e-6
+#define MAX_UNSYNC_DRIFT 500e-6
+
+struct ntp_server {
+	int fd;
+	struct refclock_context *refclock;
+	struct refclock_sample sample;
+	unsigned long sample_steps;
+	int have_sample;
+};
+
+static int parse_address(const char *address, struct addrinfo **res) {
+	char buf[256], *host, *port, *s;
+	struct addrinfo hints;
+	int r;
+
+	if (snprintf(buf, sizeof buf, "%s", address) >= sizeof buf)
+		return 0;
+
+	host = buf;
+	port = NULL;
+
+	if (buf[0] == '[') {
+		s = strchr(buf, ']');
+		if (!s || (s[1] != '\0' && s[1] != ':')) {
+			fprintf(stderr, "Could not parse address %s\n", address);
+			return 0;
+		}
+		if (s[1] == ':')
+			port = s + 2;
+		*s = '\0';
+		host = buf + 1;
+	} else if ((s = strchr(buf, ':')) && !strchr(s + 1, ':')) {
+		*s = '\0';
+		port = s + 1;
+	}
+
+	memset(&hints, 0, sizeof hints);
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_DGRAM;
+	hints.ai_flags = AI_NUMERICHOST | AI_NUMERICSERV | AI_PASSIVE;
+
+	r = getaddrinfo(host, port ? port : DEFAULT_PORT, &hints, res);
+	if (r) {
+		fprintf(stderr, "Could not parse address %s: %s\n",
+			address, gai_strerror(r));
+		return 0;
+	}
+
+	return 1;
+}
+
+struct ntp_server *server_open(const char *address,
+			       struct refclock_context *refclock) {
+	struct ntp_server *server;
+	struct addrinfo *ai;
+	int fd, on = 1;
+
+	if (!parse_address(address, &ai))
+		return NULL;
+
+	fd = socket(ai->ai_family, SOCK_DGRAM, 0);
+	if (fd < 0) {
+		fprintf(stderr, "socket() failed: %m\n");
+		freeaddrinfo(ai);
+		return NULL;
+	}
+
+	if (setsockopt(fd, SOL_SOCKET, SO_TIMESTAMPNS, &on, sizeof on) < 0)
+		DPRINTF(1, ("setsockopt(SO_TIMESTAMPNS) failed: %m\n"));
+
+	if (bind(fd, ai->ai_addr, ai->ai_addrlen) < 0) {
+		fprintf(stderr, "Could not bind to %s: %m\n", address);
+		freeaddrinfo(ai);
+		close(fd);
+		return NULL;
+	}
+
+	freeaddrinfo(ai);
+
+	server = calloc(1, sizeof *server);
+	if (!server) {
+		close(fd);
+		return NULL;
+	}
+
+	server->fd = fd;
+	server->refclock = refclock;
+
+	DPRINTF(2, ("server bound to %s\n", address));
+	return server;
+}
+
+int server_get_fd(struct ntp_server *server) {
+	return server->fd;
+}
+
+void server_set_sample(struct ntp_server *server,
+		       const struct refclock_sample *sample) {
+	server->sample = *sample;
+	server->sample_steps = refclock_get_steps(server->refclock);
+	server->have_sample = 1;
+}
+
+/* Forget the sample if the system clock was stepped after it was made, its
+   offset doesn't apply to the clock anymore */
+static void check_step(struct ntp_server *server) {
+	if (!server->have_sample ||
+	    server->sample_steps == refclock_get_steps(server->refclock))
+		return;
+
+	DPRINTF(1, ("server dropping sample made before clock step\n"));
+	server->have_sample = 0;
+}
+
+static void get_ntp_time(const struct timespec *ts, double offset,
+			 l_fp *time) {
+	long long sec, nsec;
+	l_fp t;
+
+	nsec = ts->tv_nsec + llround(offset * 1e9);
+	sec = ts->tv_sec + nsec / 1000000000;
+	nsec %= 1000000000;
+	if (nsec < 0) {
+		nsec += 1000000000;
+		sec--;
+	}
+
+	t.l_ui = (u_int32)(sec + JAN_1970);
+	t.l_uf = (u_int32)(((unsigned long long)nsec << 32) / 1000000000);
+
+	HTONL_FP(&t, time);
+}
+
+static int get_rx_time(struct msghdr *msg, struct timespec *ts) {
+	struct cmsghdr *cmsg;
+
+	for (cmsg = CMSG_FIRSTHDR(msg); cmsg; cmsg = CMSG_NXTHDR(msg, cmsg)) {
+		if (cmsg->cmsg_level == SOL_SOCKET &&
+		    cmsg->cmsg_type == SCM_TIMESTAMPNS) {
+			memcpy(ts, CMSG_DATA(cmsg), sizeof *ts);
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+static int get_leap(struct ntp_server *server, double age) {
+	struct peer *peer;
+
+	peer = refclock_get_peer(server->refclock);
+
+	if (!server->have_sample || age < 0.0 ||
+	    age > (double)(MAX_SAMPLE_POLLS << peer->hpoll) ||
+	    server->sample.leap == LEAP_NOTINSYNC)
+		return LEAP_NOTINSYNC;
+
+	if (server->sample.leap != LEAP_NOWARNING)
+		return server->sample.leap;
+
+	if (sys_leap == LEAP_ADDSECOND || sys_leap == LEAP_DELSECOND)
+		return sys_leap;
+
+	return LEAP_NOWARNING;
+}
+
+static void make_response(struct ntp_server *server, const struct pkt *request,
+			  const struct timespec *rx_ts, struct pkt *response) {
+	struct refclock_sample *sample;
+	double age, dispersion;
+	int leap;
+
+	sample = &server->sample;
+
+	age = rx_ts->tv_sec - sample->time.tv_sec +
+		(rx_ts->tv_nsec - sample->time.tv_nsec) / 1e9;
+	leap = get_leap(server, age);
+
+	dispersion = SERVER_DISPERSION;
+	if (leap != LEAP_NOTINSYNC)
+		dispersion += age * (sys_leap == LEAP_NOTINSYNC ?
+				     MAX_UNSYNC_DRIFT : MAX_SYNC_DRIFT);
+
+	memset(response, 0, sizeof *response);
+	response->li_vn_mode = PKT_LI_VN_MODE(leap,
+					      PKT_VERSION(request->li_vn_mode),
+					      MODE_SERVER);
+	response->stratum = STRATUM_TO_PKT(leap == LEAP_NOTINSYNC ?
+					   STRATUM_UNSPEC : 1);
+	response->ppoll = request->ppoll;
+	response->precision = SERVER_PRECISION;
+	response->rootdelay = 0;
+	response->rootdisp = HTONS_FP(DTOUFP(dispersion));
+	response->refid = refclock_get_peer(server->refclock)->refid;
+	response->org = request->xmt;
+
+	if (server->have_sample) {
+		get_ntp_time(&sample->time, sample->offset, &response->reftime);
+		get_ntp_time(rx_ts, sample->offset, &response->rec);
+	} else {
+		get_ntp_time(rx_ts, 0.0, &response->rec);
+	}
+}
+
+int server_process(int fd, void *arg) {
+	struct ntp_server *server = arg;
+	union {
+		struct pkt pkt;
+		char buf[1024];
+	} request;
+	char cmsgbuf[256];
+	struct pkt response;
+	struct sockaddr_storage sa;
+	struct timespec rx_ts, tx_ts;
+	struct msghdr msg;
+	struct iovec iov;
+	ssize_t len;
+
+	iov.iov_base = &request;
+	iov.iov_len = sizeof request;
+	memset(&msg, 0, sizeof msg);
+	msg.msg_name = &sa;
+	msg.msg_namelen = sizeof sa;
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = cmsgbuf;
+	msg.msg_controllen = sizeof cmsgbuf;
+
+	len = recvmsg(fd, &msg, MSG_DONTWAIT);
+	if (len < 0) {
+		DPRINTF(2, ("server recvmsg() failed: %m\n"));
+		return 1;
+	}
+
+	if (!get_rx_time(&msg, &rx_ts))
+		clock_gettime(CLOCK_REALTIME, &rx_ts);
+
+	if (len < LEN_PKT_NOMAC ||
+	    PKT_MODE(request.pkt.li_vn_mode) != MODE_CLIENT ||
+	    PKT_VERSION(request.pkt.li_vn_mode) < NTP_OLDVERSION ||
+	    PKT_VERSION(request.pkt.li_vn_mode) > NTP_VERSION) {
+		DPRINTF(2, ("server ignoring invalid request\n"));
+		return 1;
+	}
+
+	check_step(server);
+
+	make_response(server, &request.pkt, &rx_ts, &response);
+
+	clock_gettime(CLOCK_REALTIME, &tx_ts);
+	get_ntp_time(&tx_ts, server->have_sample ? server->sample.offset : 0.0,
+		     &response.xmt);
+
+	if (sendto(fd, &response, LEN_PKT_NOMAC, 0, (struct sockaddr *)&sa,
+		   msg.msg_namelen) < 0)
+		DPRINTF(2, ("server sendto() failed: %m\n"));
+
+	return 1;
+}
+
+void server_close(struct ntp_server *server) {
+	close(server->fd);
+	free(server);
+}
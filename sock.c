@@ -31,7 +31,11 @@
 #include <config.h>
 #include <ntpd.h>
 
+#include "probes.h"
 #include "sock.h"
+#ifdef HAVE_IO_URING
+#include "uring.h"
+#endif
 
 #define SOCK_MAGIC 0x534f434b
 
@@ -80,17 +84,40 @@ int sock_open(const char *path) {
 	return fd;
 }
 
-int sock_send_sample(int fd, struct timeval *tv, double offset, int leap) {
+int sock_send_sample(int fd, struct timespec *ts, double offset, int leap) {
 	struct sock_sample sample;
+	ssize_t ret;
+
+	/* The SOCK protocol has only microsecond resolution */
+	sample.tv.tv_sec = ts->tv_sec;
+	sample.tv.tv_usec = (ts->tv_nsec + 500) / 1000;
+	if (sample.tv.tv_usec >= 1000000) {
+		sample.tv.tv_sec++;
+		sample.tv.tv_usec -= 1000000;
+	}
+
+	PROBE(sock_send, fd, (long long)sample.tv.tv_sec,
+	      (long)sample.tv.tv_usec, (long long)(offset * 1e9), leap);
 
-	sample.tv = *tv;
 	sample.offset = offset;
 	sample.pulse = 0;
 	sample.leap = leap;
 	sample._pad = 0;
 	sample.magic = SOCK_MAGIC;
 
-	if (send(fd, &sample, sizeof sample, 0) != sizeof sample) {
+#ifdef HAVE_IO_URING
+	/* Submit the sample with the next wait of the main loop */
+	if (uring_send(fd, &sample, sizeof sample)) {
+		PROBE(sock_sent, fd, 0);
+		return 1;
+	}
+#endif
+
+	ret = send(fd, &sample, sizeof sample, 0);
+
+	PROBE(sock_sent, fd, ret);
+
+	if (ret != sizeof sample) {
 		fprintf(stderr, "Could not send sample: %m\n");
 		return 0;
 	}
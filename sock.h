@@ -27,7 +27,7 @@
 #define HAVE_SOCK_H
 
 int sock_open(const char *path);
-int sock_send_sample(int fd, struct timeval *tv, double offset, int leap);
+int sock_send_sample(int fd, struct timespec *ts, double offset, int leap);
 int sock_close(int fd);
 
 #endif
@@ -0,0 +1,165 @@
+/*
+ * Copyright (C) 2026  Miroslav Lichvar <mlichvar@redhat.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <config.h>
+#include <ntp_calendar.h>
+#include <ntpd.h>
+
+#include "refclock.h"
+#include "state.h"
+#include "stubs.h"
+
+/*
+ * State file keeping the last date confirmed by a valid sample and a leap
+ * second announced by the clock or the system, which are restored on start
+ * to seed the base date for resolving of the GPS week rollover (instead of
+ * the build date) and sys_leap.  The file is opened before changing the
+ * root directory and rewritten in place when the state changes.
+ */
+
+/* Days before the last date to be used as the base date */
+#define BASEDATE_MARGIN 14
+
+#define MAX_STATE_LENGTH 128
+
+static int state_fd = -1;
+static int state_day;
+static int state_leap;
+static time_t state_leap_end;
+
+static void write_state(void) {
+	char buf[MAX_STATE_LENGTH];
+	int len;
+
+	len = snprintf(buf, sizeof buf, "day %d\nleap %d %lld\n", state_day,
+		       state_leap, (long long)state_leap_end);
+
+	if (pwrite(state_fd, buf, len, 0) != len ||
+	    ftruncate(state_fd, len))
+		fprintf(stderr, "Could not write state: %m\n");
+}
+
+static void restore_state(void) {
+	char buf[MAX_STATE_LENGTH];
+	long long leap_end;
+	ssize_t len;
+
+	len = pread(state_fd, buf, sizeof buf - 1, 0);
+	if (len <= 0)
+		return;
+	buf[len] = '\0';
+
+	if (sscanf(buf, "day %d\nleap %d %lld", &state_day, &state_leap,
+		   &leap_end) != 3) {
+		DPRINTF(1, ("ignoring invalid state\n"));
+		state_day = state_leap = 0;
+		return;
+	}
+
+	state_leap_end = leap_end;
+
+#if NTP_RELEASE >= 4020813
+	if (state_day - BASEDATE_MARGIN > basedate_get_day())
+		basedate_set_day(state_day - BASEDATE_MARGIN);
+#endif
+
+	if ((state_leap == LEAP_ADDSECOND || state_leap == LEAP_DELSECOND) &&
+	    time(NULL) < state_leap_end)
+		sys_leap_hold(state_leap, state_leap_end);
+	else
+		state_leap = LEAP_NOWARNING;
+
+	DPRINTF(1, ("restored state day %d leap %d\n", state_day, state_leap));
+}
+
+int state_open(const char *path) {
+	state_fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+	if (state_fd < 0) {
+		fprintf(stderr, "Could not open %s: %m\n", path);
+		return 0;
+	}
+
+	restore_state();
+
+	return 1;
+}
+
+/* Get the end of the month, when a leap second would be applied */
+static time_t get_month_end(time_t t) {
+	struct tm tm;
+
+	if (!gmtime_r(&t, &tm))
+		return 0;
+
+	tm.tm_mday = 1;
+	tm.tm_mon++;
+	tm.tm_hour = tm.tm_min = tm.tm_sec = 0;
+
+	return timegm(&tm);
+}
+
+void state_update(struct refclock_sample *sample) {
+	time_t leap_end;
+	int day, leap;
+
+	if (state_fd < 0 || sample->leap == LEAP_NOTINSYNC)
+		return;
+
+	day = sample->time.tv_sec / 86400 + NTP_TO_UNIX_DAYS;
+
+	leap = sample->leap != LEAP_NOWARNING ? sample->leap : sys_leap;
+	if (leap == LEAP_ADDSECOND || leap == LEAP_DELSECOND) {
+		leap_end = get_month_end(sample->time.tv_sec);
+	} else {
+		/* Keep the restored leap second until it is applied */
+		leap = state_leap;
+		leap_end = state_leap_end;
+		if (sample->time.tv_sec >= leap_end)
+			leap = LEAP_NOWARNING;
+	}
+
+	if (day == state_day && leap == state_leap &&
+	    (leap == LEAP_NOWARNING || leap_end == state_leap_end))
+		return;
+
+	state_day = day;
+	state_leap = leap;
+	state_leap_end = leap == LEAP_NOWARNING ? 0 : leap_end;
+
+	write_state();
+}
+
+void state_close(void) {
+	if (state_fd < 0)
+		return;
+
+	close(state_fd);
+	state_fd = -1;
+}
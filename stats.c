@@ -0,0 +1,662 @@
+/*
+ * Copyright (C) 2026  Miroslav Lichvar <mlichvar@redhat.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Offline analyzer of clockstats files written with the -c option and
+ * samples printed to the standard output.  The files are mapped to memory
+ * and split into chunks which are processed in parallel.  The results are
+ * per-day statistics, which can be saved to a cache file with the offset
+ * of the last processed line in each file, so that only newly appended data
+ * needs to be processed when the analyzer is run again.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#define CHUNK_SIZE (16 << 20)
+#define MAX_THREADS 64
+#define CACHE_VERSION 1
+#define UNIX_TO_MJD 40587
+
+struct times {
+	unsigned long count;
+	unsigned long gaps;
+	double max_gap;
+	double first;
+	double last;
+};
+
+struct day_stats {
+	int mjd;
+	struct times samples;
+	struct times codes;
+	double sum;
+	double sum2;
+	double min;
+	double max;
+	unsigned long outliers;
+	unsigned long leaps[4];
+};
+
+struct stats {
+	struct day_stats *days;
+	int num_days;
+	int max_days;
+	int last;
+};
+
+struct file {
+	const char *path;
+	int cached;
+	dev_t dev;
+	ino_t ino;
+	off_t size;
+	off_t start;
+	off_t end;
+	const char *data;
+	struct stats stats;
+};
+
+struct chunk {
+	struct file *file;
+	off_t start;
+	off_t end;
+	struct stats stats;
+};
+
+static double gap_limit = 10.0;
+static double outlier_limit = 0.01;
+
+static struct chunk *chunks;
+static int num_chunks;
+static int next_chunk;
+static pthread_mutex_t chunk_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static struct day_stats *get_day(struct stats *stats, int mjd) {
+	struct day_stats *day;
+	int lo, hi, mid;
+
+	if (stats->last < stats->num_days &&
+	    stats->days[stats->last].mjd == mjd)
+		return &stats->days[stats->last];
+
+	for (lo = 0, hi = stats->num_days; lo < hi; ) {
+		mid = (lo + hi) / 2;
+		if (stats->days[mid].mjd < mjd)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	if (lo >= stats->num_days || stats->days[lo].mjd != mjd) {
+		if (stats->num_days >= stats->max_days) {
+			stats->max_days = stats->max_days ?
+				2 * stats->max_days : 16;
+			stats->days = realloc(stats->days, stats->max_days *
+					      sizeof *stats->days);
+			if (!stats->days) {
+				fprintf(stderr, "Out of memory\n");
+				exit(1);
+			}
+		}
+
+		memmove(stats->days + lo + 1, stats->days + lo,
+			(stats->num_days - lo) * sizeof *stats->days);
+		stats->num_days++;
+
+		day = &stats->days[lo];
+		memset(day, 0, sizeof *day);
+		day->mjd = mjd;
+		day->min = INFINITY;
+		day->max = -INFINITY;
+	}
+
+	stats->last = lo;
+
+	return &stats->days[lo];
+}
+
+static void add_time(struct times *times, double t) {
+	double interval;
+
+	if (times->count > 0) {
+		interval = t - times->last;
+		if (interval > gap_limit)
+			times->gaps++;
+		if (interval > times->max_gap)
+			times->max_gap = interval;
+	} else {
+		times->first = t;
+	}
+
+	times->last = t;
+	times->count++;
+}
+
+/* Merge times from a later part of the day */
+static void merge_times(struct times *times, const struct times *later) {
+	struct times t = *later;
+
+	if (t.count == 0)
+		return;
+
+	if (times->count == 0) {
+		*times = t;
+		return;
+	}
+
+	add_time(times, t.first);
+	times->count += t.count - 1;
+	times->gaps += t.gaps;
+	if (t.max_gap > times->max_gap)
+		times->max_gap = t.max_gap;
+	times->last = t.last;
+}
+
+static void merge_stats(struct stats *stats, const struct stats *later) {
+	const struct day_stats *l;
+	struct day_stats *day;
+	int i, j;
+
+	for (i = 0; i < later->num_days; i++) {
+		l = &later->days[i];
+		day = get_day(stats, l->mjd);
+
+		merge_times(&day->samples, &l->samples);
+		merge_times(&day->codes, &l->codes);
+		day->sum += l->sum;
+		day->sum2 += l->sum2;
+		if (l->min < day->min)
+			day->min = l->min;
+		if (l->max > day->max)
+			day->max = l->max;
+		day->outliers += l->outliers;
+		for (j = 0; j < 4; j++)
+			day->leaps[j] += l->leaps[j];
+	}
+}
+
+static const char *find_field(const char *line, const char *end,
+			      const char *name) {
+	const char *s;
+	size_t len;
+
+	len = strlen(name);
+	s = memmem(line, end - line, name, len);
+
+	return s ? s + len : NULL;
+}
+
+/*
+ * Parse a sample printed in the text format, e.g.
+ * SAMPLE: time=1700000000.123456789 offset=+0.000001234 leap=0
+ */
+static void parse_sample(struct stats *stats, const char *line,
+			 const char *end) {
+	const char *time_s, *offset_s, *leap_s;
+	double time, t, offset;
+	struct day_stats *day;
+	char *e;
+	long leap;
+	int mjd;
+
+	if (!(time_s = find_field(line, end, " time=")) ||
+	    !(offset_s = find_field(line, end, " offset=")) ||
+	    !(leap_s = find_field(line, end, " leap=")))
+		return;
+
+	time = strtod(time_s, &e);
+	if (e == time_s)
+		return;
+	offset = strtod(offset_s, &e);
+	if (e == offset_s)
+		return;
+	leap = strtol(leap_s, &e, 10);
+	if (e == leap_s || leap < 0 || leap > 3)
+		return;
+
+	mjd = floor(time / 86400.0);
+	t = time - mjd * 86400.0;
+	day = get_day(stats, mjd + UNIX_TO_MJD);
+
+	add_time(&day->samples, t);
+	day->sum += offset;
+	day->sum2 += offset * offset;
+	if (offset < day->min)
+		day->min = offset;
+	if (offset > day->max)
+		day->max = offset;
+	if (fabs(offset) > outlier_limit)
+		day->outliers++;
+	day->leaps[leap]++;
+}
+
+/*
+ * Parse a line written by record_clock_stats(), e.g.
+ * 60000 43200.123 127.127.20.0 $GPRMC,...
+ */
+static void parse_clockstats(struct stats *stats, const char *line,
+			     const char *end) {
+	char *e1, *e2;
+	double t;
+	long mjd;
+
+	mjd = strtol(line, &e1, 10);
+	if (e1 == line || *e1 != ' ' || mjd <= 0)
+		return;
+
+	t = strtod(e1, &e2);
+	if (e2 == e1 || *e2 != ' ')
+		return;
+
+	add_time(&get_day(stats, mjd)->codes, t);
+}
+
+static void parse_chunk(struct chunk *chunk) {
+	const char *p, *end, *eol;
+
+	p = chunk->file->data + chunk->start;
+	end = chunk->file->data + chunk->end;
+
+	for (; p < end; p = eol + 1) {
+		eol = memchr(p, '\n', end - p);
+		if (!eol)
+			break;
+
+		if (eol - p > 8 && !memcmp(p, "SAMPLE: ", 8))
+			parse_sample(&chunk->stats, p, eol);
+		else if (*p >= '0' && *p <= '9')
+			parse_clockstats(&chunk->stats, p, eol);
+	}
+}
+
+static void *run_worker(void *arg) {
+	int i;
+
+	while (1) {
+		pthread_mutex_lock(&chunk_lock);
+		i = next_chunk++;
+		pthread_mutex_unlock(&chunk_lock);
+
+		if (i >= num_chunks)
+			break;
+
+		parse_chunk(&chunks[i]);
+	}
+
+	return NULL;
+}
+
+static int map_file(struct file *file) {
+	struct stat st;
+	const char *nl;
+	int fd;
+
+	fd = open(file->path, O_RDONLY);
+	if (fd < 0 || fstat(fd, &st)) {
+		fprintf(stderr, "Could not open %s: %m\n", file->path);
+		if (fd >= 0)
+			close(fd);
+		return 0;
+	}
+
+	if (!file->cached || st.st_dev != file->dev ||
+	    st.st_ino != file->ino || st.st_size < file->start) {
+		/* Not the file from the cache */
+		free(file->stats.days);
+		memset(&file->stats, 0, sizeof file->stats);
+		file->start = 0;
+	}
+
+	file->dev = st.st_dev;
+	file->ino = st.st_ino;
+	file->size = st.st_size;
+	file->end = file->start;
+
+	if (file->size > file->start) {
+		file->data = mmap(NULL, file->size, PROT_READ, MAP_PRIVATE,
+				  fd, 0);
+		if (file->data == MAP_FAILED) {
+			fprintf(stderr, "Could not map %s: %m\n", file->path);
+			close(fd);
+			return 0;
+		}
+
+		madvise((void *)file->data, file->size, MADV_SEQUENTIAL);
+
+		/* Process only complete lines */
+		nl = memrchr(file->data + file->start, '\n',
+			     file->size - file->start);
+		if (nl)
+			file->end = nl - file->data + 1;
+	}
+
+	close(fd);
+
+	return 1;
+}
+
+static void add_chunks(struct file *file) {
+	const char *nl;
+	off_t start, end;
+
+	for (start = file->start; start < file->end; start = end) {
+		end = start + CHUNK_SIZE;
+		if (end >= file->end) {
+			end = file->end;
+		} else {
+			nl = memchr(file->data + end, '\n', file->end - end);
+			end = nl - file->data + 1;
+		}
+
+		chunks = realloc(chunks, (num_chunks + 1) * sizeof *chunks);
+		if (!chunks) {
+			fprintf(stderr, "Out of memory\n");
+			exit(1);
+		}
+
+		memset(&chunks[num_chunks], 0, sizeof *chunks);
+		chunks[num_chunks].file = file;
+		chunks[num_chunks].start = start;
+		chunks[num_chunks].end = end;
+		num_chunks++;
+	}
+}
+
+static int parse_cached_day(struct stats *stats, const char *line) {
+	struct day_stats d, *day;
+
+	if (sscanf(line, "DAY %d %lu %lu %la %la %la %lu %lu %la %la %la "
+		   "%la %la %la %la %lu %lu %lu %lu %lu",
+		   &d.mjd, &d.samples.count, &d.samples.gaps,
+		   &d.samples.max_gap, &d.samples.first, &d.samples.last,
+		   &d.codes.count, &d.codes.gaps, &d.codes.max_gap,
+		   &d.codes.first, &d.codes.last, &d.sum, &d.sum2, &d.min,
+		   &d.max, &d.outliers, &d.leaps[0], &d.leaps[1], &d.leaps[2],
+		   &d.leaps[3]) != 20)
+		return 0;
+
+	day = get_day(stats, d.mjd);
+	*day = d;
+
+	return 1;
+}
+
+static int read_cache(const char *path, struct file *files, int num_files) {
+	unsigned long long dev, ino, offset;
+	struct file *file = NULL;
+	double gap, outlier;
+	int i, version, n;
+	char line[4096];
+	FILE *f;
+
+	f = fopen(path, "r");
+	if (!f) {
+		if (errno == ENOENT)
+			return 1;
+		fprintf(stderr, "Could not open %s: %m\n", path);
+		return 0;
+	}
+
+	/* Ignore the cache if it was made with different limits */
+	if (!fgets(line, sizeof line, f) ||
+	    sscanf(line, "CACHE %d %la %la", &version, &gap, &outlier) != 3 ||
+	    version != CACHE_VERSION || gap != gap_limit ||
+	    outlier != outlier_limit) {
+		fclose(f);
+		return 1;
+	}
+
+	while (fgets(line, sizeof line, f)) {
+		line[strcspn(line, "\n")] = '\0';
+
+		if (!strncmp(line, "FILE ", 5)) {
+			file = NULL;
+			if (sscanf(line, "FILE %llu %llu %llu %n",
+				   &dev, &ino, &offset, &n) != 3)
+				continue;
+			for (i = 0; i < num_files; i++) {
+				if (strcmp(files[i].path, line + n))
+					continue;
+				file = &files[i];
+				file->cached = 1;
+				file->dev = dev;
+				file->ino = ino;
+				file->start = offset;
+				break;
+			}
+		} else if (file && !parse_cached_day(&file->stats, line)) {
+			file->cached = 0;
+			file = NULL;
+		}
+	}
+
+	fclose(f);
+
+	return 1;
+}
+
+static int write_cache(const char *path, struct file *files, int num_files) {
+	char tmp_path[4096];
+	struct day_stats *d;
+	int i, j;
+	FILE *f;
+
+	if (snprintf(tmp_path, sizeof tmp_path, "%s.tmp", path) >=
+	    sizeof tmp_path)
+		return 0;
+
+	f = fopen(tmp_path, "w");
+	if (!f) {
+		fprintf(stderr, "Could not open %s: %m\n", tmp_path);
+		return 0;
+	}
+
+	fprintf(f, "CACHE %d %a %a\n", CACHE_VERSION, gap_limit,
+		outlier_limit);
+
+	for (i = 0; i < num_files; i++) {
+		fprintf(f, "FILE %llu %llu %llu %s\n",
+			(unsigned long long)files[i].dev,
+			(unsigned long long)files[i].ino,
+			(unsigned long long)files[i].end, files[i].path);
+
+		for (j = 0; j < files[i].stats.num_days; j++) {
+			d = &files[i].stats.days[j];
+			fprintf(f, "DAY %d %lu %lu %a %a %a %lu %lu %a %a %a "
+				"%a %a %a %a %lu %lu %lu %lu %lu\n",
+				d->mjd, d->samples.count, d->samples.gaps,
+				d->samples.max_gap, d->samples.first,
+				d->samples.last, d->codes.count,
+				d->codes.gaps, d->codes.max_gap,
+				d->codes.first, d->codes.last, d->sum,
+				d->sum2, d->min, d->max, d->outliers,
+				d->leaps[0], d->leaps[1], d->leaps[2],
+				d->leaps[3]);
+		}
+	}
+
+	if (fclose(f) || rename(tmp_path, path)) {
+		fprintf(stderr, "Could not write %s: %m\n", path);
+		unlink(tmp_path);
+		return 0;
+	}
+
+	return 1;
+}
+
+static void print_stats(const struct stats *stats) {
+	const struct day_stats *d;
+	char date[16];
+	double mean;
+	time_t t;
+	int i;
+
+	printf("%-5s %-10s %8s %12s %12s %12s %12s %8s %5s %9s %5s %5s %5s "
+	       "%8s %8s\n", "MJD", "Date", "Samples", "Mean", "RMS", "Min",
+	       "Max", "Outliers", "Gaps", "MaxGap", "Leap1", "Leap2", "Leap3",
+	       "Codes", "CodeGaps");
+
+	for (i = 0; i < stats->num_days; i++) {
+		d = &stats->days[i];
+
+		t = (time_t)(d->mjd - UNIX_TO_MJD) * 86400;
+		if (!strftime(date, sizeof date, "%Y-%m-%d", gmtime(&t)))
+			date[0] = '\0';
+
+		printf("%-5d %-10s %8lu ", d->mjd, date, d->samples.count);
+
+		if (d->samples.count > 0) {
+			mean = d->sum / d->samples.count;
+			printf("%+12.9f %12.9f %+12.9f %+12.9f ", mean,
+			       sqrt(d->sum2 / d->samples.count), d->min,
+			       d->max);
+		} else {
+			printf("%12s %12s %12s %12s ", "-", "-", "-", "-");
+		}
+
+		printf("%8lu %5lu %9.3f %5lu %5lu %5lu %8lu %8lu\n",
+		       d->outliers, d->samples.gaps, d->samples.max_gap,
+		       d->leaps[1], d->leaps[2], d->leaps[3], d->codes.count,
+		       d->codes.gaps);
+	}
+}
+
+static void print_help(const char *name) {
+	fprintf(stderr,
+		"Usage: %s [OPTION]... FILE...\n"
+		"\nPrint daily statistics of clockstats files and samples printed\n"
+		"by ntp-refclock. Files need to be specified in chronological order.\n"
+		"\nOptions:\n"
+		"  -c FILE\tCache results in FILE and process only new data\n"
+		"  -g INTERVAL\tCount gaps longer than INTERVAL (default: 10)\n"
+		"  -o LIMIT\tCount offsets larger than LIMIT (default: 0.01)\n"
+		"  -j THREADS\tUse THREADS threads (default: number of CPUs)\n"
+		"  -v\t\tPrint version\n"
+		"  -h\t\tPrint usage\n",
+		name);
+}
+
+int main(int argc, char **argv) {
+	pthread_t threads[MAX_THREADS];
+	const char *cache = NULL;
+	struct stats stats;
+	struct file *files;
+	int i, opt, num_files, num_threads;
+
+	num_threads = sysconf(_SC_NPROCESSORS_ONLN);
+
+	while ((opt = getopt(argc, argv, "c:g:j:o:vh")) != -1) {
+		switch (opt) {
+		case 'c':
+			cache = optarg;
+			break;
+		case 'g':
+			gap_limit = atof(optarg);
+			break;
+		case 'j':
+			num_threads = atoi(optarg);
+			break;
+		case 'o':
+			outlier_limit = atof(optarg);
+			break;
+		case 'v':
+			printf("%s %s\n", PROGRAM_NAME, PROGRAM_VERSION);
+			return 0;
+		default:
+			print_help(argv[0]);
+			return opt != 'h';
+		}
+	}
+
+	if (optind >= argc) {
+		print_help(argv[0]);
+		return 1;
+	}
+
+	if (num_threads < 1)
+		num_threads = 1;
+	if (num_threads > MAX_THREADS)
+		num_threads = MAX_THREADS;
+
+	num_files = argc - optind;
+	files = calloc(num_files, sizeof *files);
+	if (!files)
+		return 1;
+
+	for (i = 0; i < num_files; i++)
+		files[i].path = argv[optind + i];
+
+	if (cache && !read_cache(cache, files, num_files))
+		return 1;
+
+	for (i = 0; i < num_files; i++) {
+		if (!map_file(&files[i]))
+			return 1;
+		add_chunks(&files[i]);
+	}
+
+	if (num_threads > num_chunks)
+		num_threads = num_chunks;
+
+	for (i = 0; i < num_threads; i++) {
+		if (pthread_create(&threads[i], NULL, run_worker, NULL)) {
+			fprintf(stderr, "pthread_create() failed\n");
+			return 1;
+		}
+	}
+
+	for (i = 0; i < num_threads; i++)
+		pthread_join(threads[i], NULL);
+
+	/* Chunks are ordered by file and position in the file */
+	for (i = 0; i < num_chunks; i++) {
+		merge_stats(&chunks[i].file->stats, &chunks[i].stats);
+		free(chunks[i].stats.days);
+	}
+
+	if (cache && !write_cache(cache, files, num_files))
+		return 1;
+
+	memset(&stats, 0, sizeof stats);
+	for (i = 0; i < num_files; i++)
+		merge_stats(&stats, &files[i].stats);
+
+	print_stats(&stats);
+
+	return 0;
+}
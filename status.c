@@ -0,0 +1,157 @@
+/*
+ * Copyright (C) 2026  Miroslav Lichvar <mlichvar@redhat.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <config.h>
+#include <ntpd.h>
+#include <timespecops.h>
+
+#include "refclock.h"
+#include "status.h"
+
+/*
+ * Status of a clock published in a shared memory-mapped file.  The writer
+ * makes the sequence number odd before updating the fields and even after
+ * the update, so that readers can detect and retry torn reads.
+ */
+
+struct status {
+	struct refclock_status *page;
+	size_t size;
+	int fd;
+};
+
+struct status *status_open(const char *path, sockaddr_u *addr) {
+	struct status *status;
+	long page_size;
+
+	status = calloc(1, sizeof *status);
+	if (!status) {
+		fprintf(stderr, "Could not allocate memory\n");
+		return NULL;
+	}
+
+	page_size = sysconf(_SC_PAGESIZE);
+	status->size = (sizeof *status->page + page_size - 1) / page_size *
+		page_size;
+
+	status->fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+	if (status->fd < 0) {
+		fprintf(stderr, "Could not open %s: %m\n", path);
+		free(status);
+		return NULL;
+	}
+
+	if (ftruncate(status->fd, status->size)) {
+		fprintf(stderr, "Could not resize %s: %m\n", path);
+		close(status->fd);
+		free(status);
+		return NULL;
+	}
+
+	status->page = mmap(NULL, status->size, PROT_READ | PROT_WRITE,
+			    MAP_SHARED, status->fd, 0);
+	if (status->page == MAP_FAILED) {
+		fprintf(stderr, "Could not map %s: %m\n", path);
+		close(status->fd);
+		free(status);
+		return NULL;
+	}
+
+	memset(status->page, 0, sizeof *status->page);
+	status->page->magic = REFCLOCK_STATUS_MAGIC;
+	status->page->version = REFCLOCK_STATUS_VERSION;
+	status->page->clock = SRCADR(addr);
+	status->page->leap = LEAP_NOTINSYNC;
+
+	return status;
+}
+
+void status_close(struct status *status) {
+	munmap(status->page, status->size);
+	close(status->fd);
+	free(status);
+}
+
+static void begin_update(struct refclock_status *page) {
+	struct timespec now;
+
+	__atomic_store_n(&page->sequence, page->sequence + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+
+	clock_gettime(CLOCK_REALTIME, &now);
+	page->update_time = now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
+static void end_update(struct refclock_status *page) {
+	__atomic_store_n(&page->sequence, page->sequence + 1, __ATOMIC_RELEASE);
+}
+
+void status_update_sample(struct status *status,
+			  struct refclock_sample *sample) {
+	struct refclock_status *page = status->page;
+
+	begin_update(page);
+
+	page->sample_time = sample->time.tv_sec * 1000000000LL +
+		sample->time.tv_nsec;
+	page->offset = sample->offset;
+	page->leap = sample->leap;
+	page->samples++;
+
+	end_update(page);
+}
+
+void status_update_timer(struct status *status, struct peer *peer,
+			 unsigned long reads, l_fp *last_read) {
+	struct refclock_status *page = status->page;
+	struct refclockproc *proc = peer->procptr;
+	struct timespec ts;
+
+	begin_update(page);
+
+	page->sys_leap = sys_leap;
+	page->reads = reads;
+	if (reads > 0) {
+		ts = lfp_stamp_to_tspec(*last_read, NULL);
+		page->read_time = ts.tv_sec * 1000000000LL + ts.tv_nsec;
+	}
+
+	page->driver_down = !proc;
+	if (proc) {
+		page->polls = proc->polls;
+		page->noreply = proc->noreply;
+		page->badformat = proc->badformat;
+		page->baddata = proc->baddata;
+	}
+
+	end_update(page);
+}
@@ -0,0 +1,87 @@
+/*
+ * Copyright (C) 2026  Miroslav Lichvar <mlichvar@redhat.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef HAVE_STATUS_H
+#define HAVE_STATUS_H
+
+#include <stdint.h>
+
+#define REFCLOCK_STATUS_MAGIC 0x4e525354
+#define REFCLOCK_STATUS_VERSION 1
+
+/*
+ * Layout of the status file (in the native byte order).  A reader should
+ * load the sequence number (with acquire semantics), copy the struct, and
+ * load the sequence number again after an acquire fence.  The copy is
+ * consistent if both numbers are equal and even.  Times are in nanoseconds
+ * since 1970 (system time).
+ */
+struct refclock_status {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t sequence;
+
+	/* Address of the reference clock (127.127.TYPE.UNIT) */
+	uint32_t clock;
+
+	/* Time of the last update of the status */
+	int64_t update_time;
+
+	/* Last sample */
+	int64_t sample_time;
+	double offset;
+	int32_t leap;
+
+	/* Leap status of the system */
+	int32_t sys_leap;
+
+	uint64_t samples;
+
+	/* Number of reads and time of the last read from the device */
+	uint64_t reads;
+	int64_t read_time;
+
+	/* Counters of the driver */
+	uint64_t polls;
+	uint64_t noreply;
+	uint64_t badformat;
+	uint64_t baddata;
+
+	/* Non-zero if the driver is stopped after a failure of the device */
+	int32_t driver_down;
+	int32_t _pad;
+};
+
+struct status;
+struct refclock_sample;
+
+struct status *status_open(const char *path, sockaddr_u *addr);
+void status_close(struct status *status);
+void status_update_sample(struct status *status,
+			  struct refclock_sample *sample);
+void status_update_timer(struct status *status, struct peer *peer,
+			 unsigned long reads, l_fp *last_read);
+
+#endif
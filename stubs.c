@@ -32,6 +32,8 @@
 #include <config.h>
 #include <ntpd.h>
 
+#include "probes.h"
+#include "recorder.h"
 #include "refclock.h"
 #include "stubs.h"
 
@@ -40,6 +42,10 @@ u_long current_time;
 u_char sys_leap;
 char *sys_phone[10];
 
+/* Leap second restored from the state file */
+static int leap_hold = LEAP_NOWARNING;
+static time_t leap_hold_end;
+
 /* Used by IRIG and WWV, but does not seem to be configurable in ntpd */
 double clock_codec = 0.0;
 
@@ -54,6 +60,23 @@ int hardpps_enable;
 
 static FILE *clockstats_file = NULL;
 
+/* Preallocated storage for variables provided by drivers */
+#define MAX_VAR_LISTS 4
+#define MAX_VARS 32
+#define MAX_VAR_LENGTH 512
+
+struct var_list {
+	struct ctl_var vars[MAX_VARS + 1];
+	char text[MAX_VARS][MAX_VAR_LENGTH];
+	int used;
+};
+
+static struct var_list var_lists[MAX_VAR_LISTS];
+
+/* Variables which don't fit in the storage are written here and dropped */
+static char *var_overflow;
+static u_long var_overflow_size;
+
 /* Called by refclock_control() */
 struct peer *findexistingpeer(sockaddr_u *addr, const char *hostname,
 			      struct peer *start_peer, int mode,
@@ -62,16 +85,7 @@ struct peer *findexistingpeer(sockaddr_u *addr, const char *hostname,
 			      , int *ip_count
 #endif
 			      ) {
-	struct peer *peer;
-
-	peer = refclock_get_peer();
-	if (!peer)
-		return NULL;
-
-	if (SOCK_EQ(addr, &peer->srcadr))
-		return peer;
-
-	return NULL;
+	return refclock_find_peer(addr);
 }
 
 /* Called by refclock_receive() */
@@ -79,6 +93,7 @@ void clock_filter(struct peer *peer, double sample_offset,
 		  double sample_delay, double sample_disp) {
 	DPRINTF(2, ("clock_filter: offset %f delay %f disp %f\n",
 		    sample_offset, sample_delay, sample_disp));
+	recorder_add(REC_FILTER, 0, sample_offset);
 }
 
 /* Called by refclock_transmit() */
@@ -120,6 +135,8 @@ int mprintf_event(int evcode, struct peer *p, const char *fmt, ...) {
 void record_clock_stats(sockaddr_u *addr, const char *text) {
 	struct timespec ts;
 
+	PROBE(clockstats, text);
+
 	if (!clockstats_file)
 		return;
 
@@ -134,19 +151,132 @@ void record_clock_stats(sockaddr_u *addr, const char *text) {
 
 void report_event(int err, struct peer *peer, const char *str) {
 	DPRINTF(2, ("report_event: %s\n", str));
+	recorder_add_text(REC_EVENT, err, str);
 }
 
+/* Find the list containing kv, or get a free list if kv is NULL */
+static struct var_list *get_var_list(struct ctl_var *kv) {
+	int i;
+
+	for (i = 0; i < MAX_VAR_LISTS; i++) {
+		if (kv ? var_lists[i].vars == kv : !var_lists[i].used)
+			break;
+	}
+
+	if (i >= MAX_VAR_LISTS) {
+		assert(!kv);
+		return NULL;
+	}
+
+	if (!kv) {
+		var_lists[i].used = 1;
+		var_lists[i].vars[0].code = 0;
+		var_lists[i].vars[0].flags = EOV;
+		var_lists[i].vars[0].text = NULL;
+	}
+
+	return &var_lists[i];
+}
+
+/* Get a cleared buffer for a dropped variable */
+static char *get_var_overflow(u_long size) {
+	if (size > var_overflow_size) {
+		var_overflow = erealloc(var_overflow, size);
+		var_overflow_size = size;
+	}
+
+	memset(var_overflow, 0, size);
+
+	return var_overflow;
+}
+
+/* Called by drivers to add a variable to a list, which can be provided to
+   refclock_control() in the kv_list field */
 char *add_var(struct ctl_var **kv, u_long size, u_short def) {
-	assert(0);
-	return NULL;
+	struct var_list *list;
+	int i;
+
+	if (size > MAX_VAR_LENGTH) {
+		DPRINTF(1, ("add_var: variable too long\n"));
+		return get_var_overflow(size);
+	}
+
+	list = get_var_list(*kv);
+	if (!list) {
+		DPRINTF(1, ("add_var: too many variable lists\n"));
+		return get_var_overflow(size);
+	}
+
+	*kv = list->vars;
+
+	for (i = 0; !(list->vars[i].flags & EOV); i++)
+		;
+
+	if (i >= MAX_VARS) {
+		DPRINTF(1, ("add_var: too many variables\n"));
+		return get_var_overflow(size);
+	}
+
+	list->vars[i].code = i;
+	list->vars[i].flags = def;
+	list->vars[i].text = list->text[i];
+	list->vars[i + 1].code = 0;
+	list->vars[i + 1].flags = EOV;
+	list->vars[i + 1].text = NULL;
+
+	/* The list may be reused after free_varlist() */
+	memset(list->text[i], 0, sizeof list->text[i]);
+
+	return list->text[i];
 }
 
+/* Called by drivers to add or replace a variable in the format name=value */
 void set_var(struct ctl_var **kv, const char *data, u_long size, u_short def) {
-	assert(0);
+	struct var_list *list;
+	const char *s, *t;
+	char *text;
+	int i, truncated;
+
+	if (!data || !size)
+		return;
+
+	/* Truncate the value to fit in the storage */
+	truncated = size > MAX_VAR_LENGTH;
+	if (truncated) {
+		DPRINTF(1, ("set_var: truncating variable\n"));
+		size = MAX_VAR_LENGTH;
+	}
+
+	list = *kv ? get_var_list(*kv) : NULL;
+
+	for (i = 0; list && !(list->vars[i].flags & EOV); i++) {
+		for (s = data, t = list->vars[i].text;
+		     *t && *t != '=' && *s == *t; s++, t++)
+			;
+		if (*s == *t && (*t == '=' || !*t))
+			break;
+	}
+
+	if (list && !(list->vars[i].flags & EOV)) {
+		list->vars[i].flags = def;
+		text = list->text[i];
+	} else {
+		text = add_var(kv, size, def);
+	}
+
+	memcpy(text, data, size);
+	if (truncated)
+		text[size - 1] = '\0';
 }
 
 void free_varlist(struct ctl_var *kv) {
-	assert(!kv);
+	struct var_list *list;
+
+	if (!kv)
+		return;
+
+	list = get_var_list(kv);
+	list->used = 0;
 }
 
 const char *get_ext_sys_var(const char *tag) {
@@ -196,9 +326,23 @@ void sys_leap_update(void) {
 		}
 	}
 
+	/* Keep the restored leap second until the system clock has it */
+	if (sys_leap == LEAP_NOWARNING && leap_hold != LEAP_NOWARNING) {
+		if (time(NULL) < leap_hold_end)
+			sys_leap = leap_hold;
+		else
+			leap_hold = LEAP_NOWARNING;
+	}
+
 	DPRINTF(2, ("sys_leap_update: leap %d\n", sys_leap));
 }
 
+void sys_leap_hold(int leap, time_t end) {
+	leap_hold = leap;
+	leap_hold_end = end;
+	sys_leap = leap;
+}
+
 int sys_phone_add(char *number) {
 	int i;
 
@@ -29,6 +29,7 @@
 int clockstats_open(const char *path);
 void clockstats_close(void);
 void sys_leap_update(void);
+void sys_leap_hold(int leap, time_t end);
 int sys_phone_add(char *number);
 
 #endif
@@ -0,0 +1,338 @@
+/*
+ * Copyright (C) 2026  Miroslav Lichvar <mlichvar@redhat.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <assert.h>
+#include <liburing.h>
+#include <poll.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include <config.h>
+#include <ntpd.h>
+
+#include "uring.h"
+
+/*
+ * Optional io_uring backend of the main loop.  A read is kept armed on the
+ * device fd and it is resubmitted together with queued sends in the same
+ * io_uring_enter() call which waits for the next completion, i.e. a sample
+ * received and forwarded costs one syscall instead of poll(), read() and
+ * send().  The device is opened in the non-blocking mode, so the read is
+ * linked to a poll of the fd to not complete with -EAGAIN immediately.
+ */
+
+#define URING_ENTRIES 16
+#define URING_SENDS 8
+#define URING_SEND_SIZE 64
+#define URING_POLLS 8
+
+/* Operations encoded in the lower byte of user_data */
+#define URING_OP_READ 1
+#define URING_OP_SEND 2
+#define URING_OP_CANCEL 3
+#define URING_OP_POLL 4
+#define URING_OP_READ_POLL 5
+
+struct uring_send_slot {
+	unsigned char data[URING_SEND_SIZE];
+	int busy;
+};
+
+struct uring_context {
+	struct io_uring ring;
+	int active;
+	int read_armed;
+	int read_fd;
+	int polls_armed[URING_POLLS];
+	int send_failed;
+	struct uring_send_slot sends[URING_SENDS];
+};
+
+static struct uring_context uring_context;
+
+static struct io_uring_sqe *get_sqe(struct uring_context *uring) {
+	struct io_uring_sqe *sqe;
+
+	sqe = io_uring_get_sqe(&uring->ring);
+	if (!sqe) {
+		/* The submission queue is full, flush it */
+		io_uring_submit(&uring->ring);
+		sqe = io_uring_get_sqe(&uring->ring);
+	}
+
+	assert(sqe);
+
+	return sqe;
+}
+
+/* Process all available completions and set revents of the descriptors
+   which are ready.  Returns the number of ready descriptors. */
+static int process_completions(struct uring_context *uring,
+			       struct pollfd *fds, int nfds, ssize_t *len) {
+	struct io_uring_cqe *cqe;
+	unsigned int head, n = 0;
+	int i, ret = 0;
+	__u64 data;
+
+	io_uring_for_each_cqe(&uring->ring, head, cqe) {
+		n++;
+		data = io_uring_cqe_get_data64(cqe);
+		i = data >> 8;
+
+		switch (data & 0xff) {
+		case URING_OP_READ:
+			uring->read_armed = 0;
+			if (cqe->res == -EAGAIN || cqe->res == -ECANCELED ||
+			    uring->read_fd < 0 || nfds < 1)
+				break;
+			*len = cqe->res;
+			fds[0].revents = POLLIN;
+			ret++;
+			break;
+		case URING_OP_READ_POLL:
+			/* A failed poll cancels the linked read, report
+			   the error as its result */
+			if (cqe->res >= 0 || cqe->res == -ECANCELED ||
+			    uring->read_fd < 0 || nfds < 1)
+				break;
+			*len = cqe->res;
+			fds[0].revents = POLLIN;
+			ret++;
+			break;
+		case URING_OP_POLL:
+			uring->polls_armed[i] = 0;
+			if (cqe->res < 0 || i >= nfds)
+				break;
+			fds[i].revents = cqe->res;
+			ret++;
+			break;
+		case URING_OP_SEND:
+			uring->sends[i].busy = 0;
+			if (cqe->res < 0) {
+				/* Let the next sample be sent directly to
+				   report the error */
+				DPRINTF(1, ("io_uring send failed: %s\n",
+					    strerror(-cqe->res)));
+				uring->send_failed = 1;
+			}
+			break;
+		default:
+			break;
+		}
+	}
+
+	io_uring_cq_advance(&uring->ring, n);
+
+	return ret;
+}
+
+/* Cancel the read armed on the previous device fd (and the poll it is linked
+   to) and wait for its completion, so the buffer is not written to later */
+static int cancel_read(struct uring_context *uring) {
+	struct io_uring_sqe *sqe;
+	struct io_uring_cqe *cqe;
+	int ret;
+
+	sqe = get_sqe(uring);
+	io_uring_prep_cancel64(sqe, URING_OP_READ_POLL, 0);
+	io_uring_sqe_set_data64(sqe, URING_OP_CANCEL);
+
+	sqe = get_sqe(uring);
+	io_uring_prep_cancel64(sqe, URING_OP_READ, 0);
+	io_uring_sqe_set_data64(sqe, URING_OP_CANCEL);
+
+	uring->read_fd = -1;
+
+	while (uring->read_armed) {
+		ret = io_uring_submit_and_wait_timeout(&uring->ring, &cqe, 1,
+						       NULL, NULL);
+		if (ret < 0 && ret != -EINTR) {
+			errno = -ret;
+			return 0;
+		}
+		process_completions(uring, NULL, 0, NULL);
+	}
+
+	return 1;
+}
+
+int uring_open(void) {
+	struct uring_context *uring = &uring_context;
+	int ret;
+
+	/* The ring can be used by only one clock */
+	if (uring->active)
+		return 0;
+
+	memset(uring, 0, sizeof *uring);
+	uring->read_fd = -1;
+
+	ret = io_uring_queue_init(URING_ENTRIES, &uring->ring, 0);
+	if (ret < 0) {
+		DPRINTF(1, ("io_uring not available (%s), using poll()\n",
+			    strerror(-ret)));
+		return 0;
+	}
+
+	uring->active = 1;
+
+	DPRINTF(1, ("using io_uring\n"));
+
+	return 1;
+}
+
+/* Wait like poll() for the descriptors in fds, except the first descriptor
+   (device) is read into buf instead of being polled.  If its revents is set
+   on return, the result of the read (as returned by read(), but with negated
+   errno) is saved to len. */
+int uring_wait(struct pollfd *fds, int nfds, void *buf, size_t buf_len,
+	       int timeout, ssize_t *len) {
+	struct uring_context *uring = &uring_context;
+	struct timespec now, deadline;
+	struct __kernel_timespec ts;
+	struct io_uring_sqe *sqe;
+	struct io_uring_cqe *cqe;
+	long long remaining;
+	int i, ret, fd;
+
+	assert(uring->active && nfds >= 1 && nfds <= URING_POLLS);
+
+	fd = fds[0].fd;
+
+	/* Some drivers change io.fd after start */
+	if (uring->read_armed && uring->read_fd != fd && !cancel_read(uring))
+		return -1;
+
+	for (i = 0; i < nfds; i++)
+		fds[i].revents = 0;
+
+	if (timeout >= 0) {
+		if (clock_gettime(CLOCK_MONOTONIC, &deadline))
+			return -1;
+		deadline.tv_sec += timeout / 1000;
+		deadline.tv_nsec += timeout % 1000 * 1000000;
+	}
+
+	for (;;) {
+		if (fd >= 0 && !uring->read_armed) {
+			/* Don't split the linked pair between two submits */
+			if (io_uring_sq_space_left(&uring->ring) < 2)
+				io_uring_submit(&uring->ring);
+
+			sqe = get_sqe(uring);
+			io_uring_prep_poll_add(sqe, fd, POLLIN | POLLPRI);
+			io_uring_sqe_set_flags(sqe, IOSQE_IO_LINK);
+			io_uring_sqe_set_data64(sqe, URING_OP_READ_POLL);
+
+			sqe = get_sqe(uring);
+			io_uring_prep_read(sqe, fd, buf, buf_len, -1);
+			io_uring_sqe_set_data64(sqe, URING_OP_READ);
+			uring->read_armed = 1;
+			uring->read_fd = fd;
+		}
+
+		for (i = 1; i < nfds; i++) {
+			if (fds[i].fd < 0 || uring->polls_armed[i])
+				continue;
+			sqe = get_sqe(uring);
+			io_uring_prep_poll_add(sqe, fds[i].fd, fds[i].events);
+			io_uring_sqe_set_data64(sqe, URING_OP_POLL | (__u64)i << 8);
+			uring->polls_armed[i] = 1;
+		}
+
+		/* Wait only for the rest of the timeout after completions
+		   which were not events (e.g. sends) */
+		if (timeout >= 0) {
+			if (clock_gettime(CLOCK_MONOTONIC, &now))
+				return -1;
+			remaining = (deadline.tv_sec - now.tv_sec) *
+				1000000000LL + deadline.tv_nsec - now.tv_nsec;
+			if (remaining < 0)
+				remaining = 0;
+			ts.tv_sec = remaining / 1000000000;
+			ts.tv_nsec = remaining % 1000000000;
+		}
+
+		ret = io_uring_submit_and_wait_timeout(&uring->ring, &cqe, 1,
+						       timeout >= 0 ? &ts : NULL,
+						       NULL);
+		if (ret < 0 && ret != -ETIME) {
+			errno = -ret;
+			return -1;
+		}
+
+		i = process_completions(uring, fds, nfds, len);
+		if (i > 0)
+			return i;
+
+		if (ret == -ETIME)
+			return 0;
+	}
+}
+
+/* Queue a send to be submitted with the next wait.  Returns 0 if the data
+   needs to be sent directly, e.g. io_uring is not active, no slot is free,
+   or a previous send failed. */
+int uring_send(int fd, const void *data, size_t len) {
+	struct uring_context *uring = &uring_context;
+	struct io_uring_sqe *sqe;
+	int i;
+
+	if (!uring->active || len > URING_SEND_SIZE)
+		return 0;
+
+	if (uring->send_failed) {
+		uring->send_failed = 0;
+		return 0;
+	}
+
+	for (i = 0; i < URING_SENDS && uring->sends[i].busy; i++)
+		;
+	if (i >= URING_SENDS)
+		return 0;
+
+	memcpy(uring->sends[i].data, data, len);
+	uring->sends[i].busy = 1;
+
+	sqe = get_sqe(uring);
+	io_uring_prep_send(sqe, fd, uring->sends[i].data, len, 0);
+	io_uring_sqe_set_data64(sqe, URING_OP_SEND | (__u64)i << 8);
+
+	return 1;
+}
+
+void uring_close(void) {
+	struct uring_context *uring = &uring_context;
+
+	if (!uring->active)
+		return;
+
+	/* Don't drop samples queued in the last iteration */
+	io_uring_submit(&uring->ring);
+
+	io_uring_queue_exit(&uring->ring);
+	uring->active = 0;
+}
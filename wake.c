@@ -0,0 +1,191 @@
+/*
+ * Copyright (C) 2026  Miroslav Lichvar <mlichvar@redhat.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <fcntl.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <config.h>
+#include <ntpd.h>
+
+#include "wake.h"
+
+/*
+ * Predictive wake window.  Serial receivers usually send their messages at
+ * a fixed phase of the second.  The phase and its spread are estimated from
+ * the receive timestamps of the first read of each message and only around
+ * the expected arrival deep idle states of the CPU are disabled through
+ * /dev/cpu_dma_latency and optionally the device is busy-polled.  Outside
+ * the window the CPU is allowed to sleep normally.
+ */
+
+#define LATENCY_DEVICE "/dev/cpu_dma_latency"
+#define LATENCY_LOW 0
+#define LATENCY_DEFAULT 2000000000
+
+/* Minimum interval between reads to consider them separate messages */
+#define MIN_MESSAGE_GAP 0.1
+
+/* Number of messages before the window is used */
+#define MIN_MESSAGES 8
+
+/* Time constant of the averaging (as a power of 2) */
+#define AVERAGING_SHIFT 3
+
+/* Maximum spread of the phase to use the window */
+#define MAX_SPREAD 0.05
+
+/* Window margin in spreads and seconds */
+#define WINDOW_SPREADS 3.0
+#define WINDOW_MARGIN 0.001
+
+struct wake_window {
+	int latency_fd;
+	int low_latency;
+	int spin;
+	double last_read;
+	double phase;
+	double spread;
+	unsigned int messages;
+};
+
+/* Get the difference of two phases in the interval [-0.5, 0.5) */
+static double diff_phase(double a, double b) {
+	double d = a - b;
+
+	return d - floor(d + 0.5);
+}
+
+static void set_latency(struct wake_window *wake, int low) {
+	int value;
+
+	if (wake->low_latency == low)
+		return;
+
+	wake->low_latency = low;
+
+	if (wake->latency_fd < 0)
+		return;
+
+	value = low ? LATENCY_LOW : LATENCY_DEFAULT;
+	if (write(wake->latency_fd, &value, sizeof value) != sizeof value)
+		DPRINTF(1, ("write(%s) failed: %m\n", LATENCY_DEVICE));
+}
+
+struct wake_window *wake_create(int spin) {
+	struct wake_window *wake;
+
+	wake = calloc(1, sizeof *wake);
+	if (!wake) {
+		fprintf(stderr, "Could not allocate memory\n");
+		return NULL;
+	}
+
+	wake->spin = spin;
+
+	/* The request is active only while the file is open */
+	wake->latency_fd = open(LATENCY_DEVICE, O_WRONLY | O_CLOEXEC);
+	if (wake->latency_fd < 0)
+		fprintf(stderr, "Could not open %s: %m\n", LATENCY_DEVICE);
+
+	return wake;
+}
+
+void wake_add_data(struct wake_window *wake, l_fp *recv_time) {
+	double t, phase, diff;
+
+	t = recv_time->l_ui + recv_time->l_uf / 4294967296.0;
+
+	/* Ignore reads of the remaining parts of the message */
+	if (t - wake->last_read < MIN_MESSAGE_GAP && t >= wake->last_read) {
+		wake->last_read = t;
+		return;
+	}
+
+	wake->last_read = t;
+	phase = t - floor(t);
+
+	if (wake->messages++ == 0) {
+		wake->phase = phase;
+		wake->spread = MAX_SPREAD;
+		return;
+	}
+
+	diff = diff_phase(phase, wake->phase);
+	wake->phase += diff / (1 << AVERAGING_SHIFT);
+	wake->phase -= floor(wake->phase);
+	wake->spread += (fabs(diff) - wake->spread) / (1 << AVERAGING_SHIFT);
+
+	DPRINTF(2, ("wake_add_data: phase %.6f spread %.6f\n",
+		    wake->phase, wake->spread));
+}
+
+/* Adjust the timeout of the main loop (in milliseconds) to wake up at the
+   start of the window and switch the CPU latency */
+int wake_adjust_timeout(struct wake_window *wake, int timeout) {
+	double width, until_start, until_end, now, phase;
+	struct timespec ts;
+
+	if (wake->messages < MIN_MESSAGES || wake->spread > MAX_SPREAD ||
+	    clock_gettime(CLOCK_REALTIME, &ts)) {
+		set_latency(wake, 0);
+		return timeout;
+	}
+
+	width = 2.0 * (WINDOW_SPREADS * wake->spread + WINDOW_MARGIN);
+	now = ts.tv_sec + (double)JAN_1970 + ts.tv_nsec / 1e9;
+	phase = ts.tv_nsec / 1e9;
+
+	until_start = wake->phase - width / 2.0 - phase;
+	until_start -= floor(until_start);
+
+	/* Stay in the window until the message is received */
+	if (until_start > 1.0 - width &&
+	    now - wake->last_read > 1.0 - until_start) {
+		set_latency(wake, 1);
+		if (wake->spin)
+			return 0;
+		until_end = width - (1.0 - until_start);
+		if (timeout < 0 || until_end * 1e3 < timeout)
+			timeout = ceil(until_end * 1e3);
+		return timeout;
+	}
+
+	set_latency(wake, 0);
+
+	if (timeout < 0 || until_start * 1e3 < timeout)
+		timeout = ceil(until_start * 1e3);
+
+	return timeout;
+}
+
+void wake_destroy(struct wake_window *wake) {
+	if (wake->latency_fd >= 0)
+		close(wake->latency_fd);
+	free(wake);
+}